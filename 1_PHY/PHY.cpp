@@ -1,52 +1,82 @@
 #include "PHY.h"
 
-uint8_t transmit_PHY(uint8_t *dll_array, uint8_t arrSize){
-	//Check to see if frame successfully passed to TX buffer
+static uint8_t rx_held = 0; //Received frame lent to DLL and not yet released
+static uint8_t rx_posted = 0; //Frame ready event waiting in the queue
+
+uint8_t* tx_buffer_PHY(void){
+	//Frames are written straight into a slot of the MAC queue, none is free until the MAC tick sends one
+	uint8_t* buf = csma_tx_buffer();
+#ifdef __PLATFORM_SIM__
+	if (!buf)
+		sim_idle(); //Callers spin on this, let the tick run
+#endif
+	return buf;
+}
+
+uint8_t transmit_PHY(uint8_t arrSize, uint8_t dest, uint8_t setting){
+	//Queue frame already in buffer, the MAC sends it once the channel is free
 	
-		uint8_t status = rfm12_tx(arrSize, 0, dll_array); //Pass frame to buffer
-		char text[4];
-		for(int i = 0; i < arrSize; i++){
-			sprintf(text, "%.2X", dll_array[i]);
-			//put_str(text);
-		}
-		put_str("\n\r");
-		if (status == RFM12_TX_ENQUEUED){
-			
-			//put_str("frame moved to transfer buffer\n\r");
-		}
-		else if (status == RFM12_TX_OCCUPIED){
-			put_str("transmit buffer full\n\r");
-			return 1; //Return status of frame in buffer
-		}
-		else if (status == RFM12_TX_ERROR){
-			put_str("packet longer than transmit buffer\n\r");
+		if (arrSize > RFM12_TX_BUFFER_SIZE){
+			LOG_ERROR("packet longer than transmit buffer\n\r");
 			return 1;
 		}
-		else {
-			put_str("ERROR!\n\r");
+		if (csma_enqueue(arrSize, dest, setting)){
+			LOG_DEBUG("transmit queue full\n\r");
+			return 1; //Return status of frame in buffer
 		}
-		csma_p(); //Flow control and transmit data
-		return 0; //Return 0 when frame succesfully transmitted
+		STATS_INC(frames_tx);
+		STATS_ADD(bytes_tx, arrSize);
+		return 0; //Return 0 when frame succesfully queued
+}
+
+void heard_PHY(uint8_t src){
+	csma_heard(src);
+}
+
+uint8_t rssi_PHY(void){
+#if RFM12_RX_RSSI
+	return rfm12_rx_rssi(); //Sampled by the radio ISR as the frame started
+#else
+	return 1;
+#endif
+}
+
+void listen_PHY(uint8_t rate){
+	csma_listen(rate);
+}
+
+void poll_PHY(void){
+	// one event per received frame, the next is posted once DLL has taken this one
+	if (!rx_posted && rfm12_rx_status() == STATUS_COMPLETE){
+		if (!event_post(EV_FRAME_READY, 0, 0))
+			rx_posted = 1;
+	}
 }
 
 uint8_t receive_PHY() {
-	//put_str("In Receive:\n\r");
-	// code from main.cpp~
-	// checks to see if a packet has been received and if so sends to UART
+	// checks to see if a packet has been received and if so lends it to DLL
+	rx_posted = 0;
 	if (rfm12_rx_status() == STATUS_COMPLETE) { //Packet received
 		//put_str("packet received\n\r");
-		uint8_t *bufptr;
-		uint8_t frame[30];
-		bufptr = rfm12_rx_buffer(); //Take RX buffer contents
-		char text[4];
-		for (uint8_t i = 0; i < rfm12_rx_len(); i++){
-			frame[i] = bufptr[i]; //Store RX buffer contents
-			sprintf(text, "%.2X", bufptr[i]);
-			//put_str(text);
-		}
-		put_str("\n\r");
-		rfm12_rx_clear(); //Clear RX Buffer	
-		return receive_DLL(frame); //Send received frame to DLL
-		
+		rx_held = 1;
+		STATS_INC(frames_rx);
+		STATS_ADD(bytes_rx, rfm12_rx_len());
+		LOG_DEBUG("\n\r");
+#if RFM12_RX_CRC16
+		uint16_t crc = rfm12_rx_crc(); //Run by the radio ISR while the frame came in
+#else
+		uint16_t crc = crc16_block(CRC16_INIT, rfm12_rx_buffer(), rfm12_rx_len());
+#endif
+		uint8_t ack = receive_DLL(rfm12_rx_buffer(), crc); //Send received frame to DLL, no copy
+		release_PHY(); //Nothing happens if DLL already released it
+		return ack;
 	}
-}
\ No newline at end of file
+	return 0;
+}
+
+void release_PHY(void){
+	if (rx_held){
+		rx_held = 0;
+		rfm12_rx_clear(); //Clear RX Buffer
+	}
+}
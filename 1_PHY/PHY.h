@@ -3,10 +3,17 @@
 
 #include <util/delay.h>
 #include <stdlib.h>
-#include "../LLC/LLC.H"
-#include "../MAC/csma.H"
+#include "../2_2_LLC/LLC.h"
+#include "../2_1_MAC/csma.h"
 
-uint8_t transmit_PHY(uint8_t *dll_array, uint8_t arrSize);
-uint8_t receive_PHY();
+uint8_t* tx_buffer_PHY(void);            // Buffer to build next frame in, 0 while the transmit queue is full
+uint8_t transmit_PHY(uint8_t arrSize, uint8_t dest, uint8_t setting);   // Queue frame built in tx_buffer_PHY() for dest, returns at once
+                                         // setting: rate and power of the frame (MAC_SETTING()), 0 = network rate at full power
+void heard_PHY(uint8_t src);             // Valid frame from src, the MAC knows it is awake
+uint8_t rssi_PHY(void);                  // 1 if the signal of the frame lent to DLL was above the RSSI threshold
+void listen_PHY(uint8_t rate);           // Rate level to receive at between frames, 0 = network rate
+void poll_PHY(void);                     // Post EV_FRAME_READY while a received frame waits, called by the main loop
+uint8_t receive_PHY();                   // Lend next received frame to DLL
+void release_PHY(void);                  // Hand received frame back to radio once DLL has consumed it
 
-#endif
\ No newline at end of file
+#endif
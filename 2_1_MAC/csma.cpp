@@ -1,7 +1,125 @@
-#include "CSMA.h"
+#include "csma.h"
+#include <string.h>
+#include <util/atomic.h>
+#include <avr/pgmspace.h>
+#include "../common/event.h"
+#include "../3_NET/NET.h"
+#include "../common/timer.h"
+#include "../common/stats.h"
+#include "../common/sram.h"
 
-uint16_t csma_slot_length = 2;
+uint16_t csma_slot_length = 1;
 uint8_t csma_probability = 70;
+uint8_t mac_always_on = MAC_ALWAYS_ON;
+
+typedef struct mac_frame{
+	uint8_t len;
+	uint8_t dest;
+	uint8_t setting; //MAC_SETTING() of the frame
+	uint8_t data[RFM12_TX_BUFFER_SIZE];
+}mac_frame;
+
+static mac_frame queue[MAC_QUEUE_SIZE];
+static volatile uint8_t q_head; //Next frame to send
+static volatile uint8_t q_count; //Frames in queue
+static uint8_t backoff; //Slots left before the channel is sensed again
+static uint8_t backoff_exp = CSMA_MIN_BE;
+static uint16_t slot_ticks;
+static uint16_t seed;
+extern void tick_NET(void);
+extern void restart_DLL_timer(void);
+
+#if MAC_LPL
+static uint8_t heard[ID_RANGE]; //MAC ticks since a frame came from each peer, saturates at MAC_LPL_HOLD
+static uint8_t rx_on = 1; //Receiver enabled
+static uint8_t awake = MAC_LPL_HOLD; //MAC ticks left before the receiver may sleep again
+static uint16_t wake_ticks; //Position in the wake-up interval
+static uint8_t train_next; //Frame in the radio goes out as a wake-up train
+static uint8_t train_dest;
+static uint16_t train; //MAC ticks left of the wake-up train being sent
+static uint8_t train_gap; //MAC ticks since the last copy left
+#endif
+
+#if RFM12_LINK_ADAPT
+static const uint8_t link_rates[MAC_RATES] PROGMEM = RFM12_LINK_RATES;
+static uint8_t tx_setting; //Setting of the frame in the radio
+static uint8_t radio_setting; //Setting the RFM12 is programmed with
+static volatile uint8_t listen_rate;
+
+// Program rate and power of setting into the RFM12, only while it neither sends nor receives
+static void radio(uint8_t setting) {
+	if (MAC_RATE(setting) != MAC_RATE(radio_setting))
+		rfm12_set_rate(pgm_read_byte(&link_rates[MAC_RATE(setting)]));
+	if (MAC_POWER(setting) != MAC_POWER(radio_setting))
+		rfm12_set_power(RFM12_POWER + MAC_POWER(setting));
+	radio_setting = setting;
+}
+
+// Radio idle, back to the rate the peers send at
+static void listen_tick(void) {
+	if (ctrl.rfm12_state != STATE_RX_IDLE)
+		return;
+#if !(RFM12_USE_POLLING)
+	if (!(RFM12_INT_MSK & (1<<RFM12_INT_BIT)))
+		return;
+#endif
+	radio(MAC_SETTING(listen_rate, MAC_POWER(radio_setting)));
+}
+#endif
+
+//xorshift, every node starts from its own seed so contending nodes do not back off in lockstep
+static uint8_t csma_rand(void) {
+	seed ^= seed << 7;
+	seed ^= seed >> 9;
+	seed ^= seed << 8;
+	return seed;
+}
+
+void csma_init(void) {
+	seed = 0xACE1 ^ (ID * 0x0101);
+	for(uint8_t i = 0; i < 8; i++)
+		csma_rand();
+
+	TCCR2A |= _BV(WGM21);                         // Set CTC mode
+	TCCR2B |= _BV(CS20) | _BV(CS21) | _BV(CS22);  // Pre-scaler to 1024
+	OCR2A = MAC_TICK_OCR;
+	TIMSK2 |= _BV(OCIE2A);
+
+	sram_budget(SRAM_RADIO, sizeof(rf_tx_buffer) + sizeof(rf_rx_buffers));
+	sram_budget(SRAM_MAC, sizeof(queue));
+#if MAC_LPL
+	sram_budget(SRAM_MAC, sizeof(heard));
+#endif
+}
+
+//First free slot. The tick moves q_head and q_count together, so they are read together;
+//their sum stays the same until the next frame is queued.
+static mac_frame* q_tail(void) {
+	uint8_t tail;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		tail = (q_head + q_count) % MAC_QUEUE_SIZE;
+	}
+	return &queue[tail];
+}
+
+uint8_t* csma_tx_buffer(void) {
+	if (q_count == MAC_QUEUE_SIZE)
+		return 0;
+	return q_tail()->data;
+}
+
+uint8_t csma_enqueue(uint8_t len, uint8_t dest, uint8_t setting) {
+	if (q_count == MAC_QUEUE_SIZE)
+		return 1;
+	mac_frame* m = q_tail();
+	m->len = len;
+	m->dest = dest;
+	m->setting = setting;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		q_count++;
+	}
+	return 0;
+}
 
 void transmit_data() {
 	RFM12_INT_OFF();
@@ -23,25 +141,177 @@ void transmit_data() {
 	RFM12_INT_ON();
 }
 
-void csma_p() {
-	srand(68); //Seed for random nuber
-	uint16_t tran_status = 0; // current state of the transceiver
-	if (ctrl.txstate == STATUS_OCCUPIED) { // data ready to transmit
-		uint8_t sent = 0; //If message sent or not
-		while (!sent) { // while the packet has not been sent
-			_delay_ms(csma_slot_length); // time slot length
-			// check channel state
+void csma_heard(uint8_t src) {
+#if MAC_LPL
+	if (src < ID_RANGE)
+		heard[src] = 0;
+#endif
+}
+
+void csma_listen(uint8_t rate) {
+#if RFM12_LINK_ADAPT
+	listen_rate = rate;
+#endif
+}
+
+#if MAC_LPL
+// 1 while a frame to dest may find its peer asleep, for a group (common/group.h) any of its members
+static uint8_t asleep(uint8_t dest) {
+	if (IS_GROUP(dest)) {
+		for (uint8_t i = 0; i < ID_RANGE; i++) {
+			if (IN_GROUP(dest, i) && heard[i] >= MAC_LPL_HOLD / 2)
+				return 1;
+		}
+		return 0;
+	}
+	return dest >= ID_RANGE || heard[dest] >= MAC_LPL_HOLD / 2;
+}
+
+static void receiver(uint8_t on) {
+	if (on == rx_on)
+		return;
+	rx_on = on;
+	RFM12_INT_OFF();
+	rfm12_data(on ? PWRMGT_RECEIVE : (RFM12_CMD_PWRMGT | PWRMGT_DEFAULT));
+	RFM12_INT_ON();
+}
+
+// Wake-up schedule of the receiver and the train of copies of a frame to a sleeping peer
+// 1 while a train is being sent, CSMA waits for it to end
+static uint8_t lpl_tick(void) {
+	if (train && (train_dest < ID_RANGE || IS_GROUP(train_dest)) && !asleep(train_dest))
+		train = 0; //Peer is awake and answered, every member of a group
+	for (uint8_t i = 0; i < ID_RANGE; i++) {
+		if (heard[i] < MAC_LPL_HOLD)
+			heard[i]++;
+	}
+	if (train) {
+		//Copies follow each other without backoff, the gap stays shorter than MAC_LPL_LISTEN.
+		//A carrier in the gap is most likely the peer answering, it is not talked over.
+		if (--train && ctrl.txstate == STATUS_FREE && ctrl.rfm12_state == STATE_RX_IDLE && ++train_gap > MAC_LPL_GAP) {
 			RFM12_INT_OFF();
-			tran_status = rfm12_read(RFM12_CMD_STATUS);
+			uint16_t status = rfm12_read(RFM12_CMD_STATUS);
 			RFM12_INT_ON();
-			if (ctrl.rfm12_state == STATE_RX_IDLE) { // if radio is idle
-				if (!(tran_status & RFM12_STATUS_RSSI)) { // if channel is idle
-					if (rand() % 100 < csma_probability) { // probability of transmitting
-						sent = 1;
-						transmit_data();
-					}
-				}
-			}
+			if (status & RFM12_STATUS_RSSI)
+				return 1;
+			train_gap = 0;
+			rfm12_start_tx(0, rf_tx_buffer.len);
+#if RFM12_LINK_ADAPT
+			radio(tx_setting);
+#endif
+			transmit_data();
+			restart_DLL_timer(); //LLC ACK timeout counts from the last copy
 		}
+		awake = MAC_LPL_HOLD;
+		return 1;
+	}
+
+	//Sending, receiving or about to, the ACKs have to be heard as well
+	if (q_count || ctrl.txstate != STATUS_FREE || ctrl.rfm12_state != STATE_RX_IDLE || mac_always_on)
+		awake = MAC_LPL_HOLD;
+	if (awake) {
+		receiver(1);
+		if (--awake == 0)
+			wake_ticks = 0;
+		return 0;
+	}
+
+	if (++wake_ticks >= MAC_LPL_INTERVAL)
+		wake_ticks = 0;
+	if (wake_ticks == 0) {
+		receiver(1);
+		return 0;
+	}
+	if (wake_ticks > MAC_LPL_LISTEN)
+		return 0;
+#if !(RFM12_USE_POLLING)
+	if (!(RFM12_INT_MSK & (1<<RFM12_INT_BIT))) //Radio ISR busy, so is the channel
+		return 0;
+#endif
+	RFM12_INT_OFF();
+	uint16_t status = rfm12_read(RFM12_CMD_STATUS);
+	RFM12_INT_ON();
+	if (status & RFM12_STATUS_RSSI)
+		awake = MAC_LPL_HOLD; //Someone is sending, stay on for the frame and the rest of the exchange
+	else if (wake_ticks == MAC_LPL_LISTEN)
+		receiver(0);
+	return 0;
+}
+#endif
+
+static void csma_tick(void) {
+#if RFM12_LINK_ADAPT
+	listen_tick();
+#endif
+#if MAC_LPL
+	if (lpl_tick())
+		return;
+#endif
+	if (ctrl.txstate == STATUS_FREE) { //Last frame has left, move next one into the radio
+		if (!q_count)
+			return;
+		mac_frame* m = &queue[q_head];
+		memcpy(rf_tx_buffer.buffer, m->data, m->len);
+		rfm12_start_tx(0, m->len);
+#if RFM12_LINK_ADAPT
+		tx_setting = m->setting;
+#endif
+#if MAC_LPL
+		train_next = asleep(m->dest);
+		train_dest = m->dest;
+#endif
+		q_head = (q_head + 1) % MAC_QUEUE_SIZE;
+		q_count--;
+		event_post(EV_TX_READY, 0, 0);
+	}
+	if (ctrl.rfm12_state != STATE_RX_IDLE) //Sending or receiving
+		return;
+#if !(RFM12_USE_POLLING)
+	if (!(RFM12_INT_MSK & (1<<RFM12_INT_BIT))) //Radio ISR is talking to the RFM12, interrupted by this tick
+		return;
+#endif
+	if (++slot_ticks < csma_slot_length)
+		return;
+	slot_ticks = 0;
+	if (backoff) {
+		backoff--;
+		STATS_INC(csma_backoffs);
+		return;
+	}
+
+	// check channel state
+	RFM12_INT_OFF();
+	uint16_t tran_status = rfm12_read(RFM12_CMD_STATUS);
+	RFM12_INT_ON();
+	if (tran_status & RFM12_STATUS_RSSI) { //Busy, back off over a window twice as long
+		if (backoff_exp < CSMA_MAX_BE)
+			backoff_exp++;
+		backoff = csma_rand() & ((1 << backoff_exp) - 1);
+	}
+	else if ((((uint16_t) csma_rand() * 100) >> 8) < csma_probability) { // probability of transmitting
+#if RFM12_LINK_ADAPT
+		radio(tx_setting);
+#endif
+		transmit_data();
+#if MAC_LPL
+		if (train_next) {
+			train = MAC_LPL_TRAIN;
+			train_gap = 0;
+		}
+		train_next = 0;
+#endif
+		backoff_exp = CSMA_MIN_BE;
+		backoff = csma_rand() & ((1 << backoff_exp) - 1); //Next frame of this node also waits, so others get a turn
+	}
+}
+
+ISR(TIMER2_COMPA_vect) {
+	static uint8_t net_ticks;
+
+	csma_tick();
+	timer_tick(); //Every software timer runs off this tick
+	if (++net_ticks == NET_TICK_DIV) {
+		net_ticks = 0;
+		tick_NET();
 	}
 }
\ No newline at end of file
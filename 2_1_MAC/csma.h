@@ -9,10 +9,63 @@
 #include "../rfm12lib/rfm12_hw.h"
 #include "../rfm12lib/rfm12_core.h"
 #include "../rfm12lib/rfm12_spi.c"
+#include "../common/group.h"
 
-void csma_p();
+#define MAC_QUEUE_SIZE 4    // Frames waiting for the channel
+#define MAC_TICK_OCR 11     // TIMER2 compare value at /1024, 1.024ms MAC tick
+#define NET_TICK_DIV 10     // MAC ticks per NET timer tick (~10ms)
+#ifndef CSMA_MIN_BE
+#define CSMA_MIN_BE 1       // Backoff exponent after a frame went out, backoff is 0 .. 2^BE-1 slots
+#endif
+#ifndef CSMA_MAX_BE
+#define CSMA_MAX_BE 3       // Backoff exponent limit while the channel stays busy, 8 slots ~ 3 frames on air
+#endif
 
-extern uint16_t csma_slot_length;
+// Low power listening, all nodes of a network must use the same setting and interval
+#ifndef MAC_LPL
+#define MAC_LPL 0           // 1 = receiver sleeps between wake-ups, frames to a sleeping peer are repeated
+#endif
+#ifndef MAC_LPL_INTERVAL
+#define MAC_LPL_INTERVAL 100    // MAC ticks (~0.1s) between wake-ups, latency against power
+#endif
+#ifndef MAC_ALWAYS_ON
+#define MAC_ALWAYS_ON 0     // Initial mac_always_on, 1 for forwarders on mains power
+#endif
+#define MAC_LPL_GAP 2       // MAC ticks between two copies of a train, the peer answers in them
+#define MAC_LPL_LISTEN 4    // MAC ticks the RSSI is sampled per wake-up, longer than the gap between two copies
+#define MAC_LPL_HOLD 100    // MAC ticks the receiver stays on after the last frame, covers the LLC ACK timeout
+#define MAC_LPL_TRAIN (MAC_LPL_INTERVAL + MAC_LPL_LISTEN)  // MAC ticks a frame to a sleeping peer is repeated
+#define MAC_BROADCAST 0xFF  // Destination of a frame for no peer in particular, always sent as a train
+
+// Radio setting of a frame under RFM12_LINK_ADAPT (rfm12lib/rfm12_config.h): rate level in
+// RFM12_LINK_RATES and TX power in 3 dB steps below RFM12_POWER, 0 = network rate at full power
+#define MAC_RATES 4         // Rate levels
+#define MAC_SETTING(rate, power) ((rate) | (power) << 2)
+#define MAC_RATE(s) ((s) & 3)
+#define MAC_POWER(s) ((s) >> 2)
+
+// p-persistent CSMA run from the TIMER2 tick
+// Frames are queued and sent in the background: every slot the RSSI is sampled once,
+// a busy channel doubles the backoff window and an idle one is taken with
+// probability csma_probability percent.
+//
+// With MAC_LPL the receiver is switched off and woken every MAC_LPL_INTERVAL ticks to
+// sample the RSSI. A carrier keeps it on until the channel has been quiet for
+// MAC_LPL_HOLD ticks. The first frame to a peer not heard within MAC_LPL_HOLD / 2 is
+// sent over and over for up to MAC_LPL_TRAIN ticks, so one copy falls into its next
+// wake-up. The peer's ACK in a gap between two copies ends the train, the rest of
+// the exchange finds it awake. A train to a group ends once every member answered.
+//
+// With RFM12_LINK_ADAPT every frame is sent at the rate and power it was queued with, the
+// radio is set back to the rate given by csma_listen() as soon as it is idle again.
+void csma_init(void);               // Start TIMER2 tick, seed backoff from ID
+uint8_t* csma_tx_buffer(void);      // Queue slot to build next frame in, 0 while queue full
+uint8_t csma_enqueue(uint8_t len, uint8_t dest, uint8_t setting);  // Queue frame built in csma_tx_buffer(), 1 if queue full
+void csma_heard(uint8_t src);       // Frame from src arrived, it is awake for a while
+void csma_listen(uint8_t rate);     // Rate level the receiver is set to whenever the radio is idle
+
+extern uint16_t csma_slot_length;   // MAC ticks per slot
 extern uint8_t csma_probability; 
+extern uint8_t mac_always_on;       // Receiver never sleeps under MAC_LPL, still sends trains to the others
 
 #endif
\ No newline at end of file
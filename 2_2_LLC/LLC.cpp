@@ -2,240 +2,780 @@
 
 uint8_t last_frame = 0; //Last frame recevied by DLL
 volatile uint8_t resend[8]; //Store which frames have been re-sent
-volatile uint8_t ACK_frames; //Store which frames have been acknowledged
-extern volatile uint8_t flLimit;
-extern volatile uint8_t ecLimit0;
-extern volatile uint8_t ecLimit1;
-extern volatile uint8_t ecLimit2;
+volatile uint8_t ACK_frames; //Bitmap of frames acknowledged, bit i = frame i+1
+uint16_t DLL_resends; //Frames sent again after an ACK timeout, NET re-probes links when it jumps
+static volatile uint8_t frames_sent; //Bitmap of frames sent at least once
+static uint8_t tx_seq; //Packet number, tells ACKs and frames of consecutive packets apart
+static pbuf* rx_pb = 0; //Network packet being reassembled
+#if LLC_ARQ == LLC_SELECTIVE_REPEAT
+static uint8_t rx_done[ID_RANGE]; //0x80 | packet number of the last packet passed up from each sender, its frames coming again are only ACKed
+#endif
+
+typedef struct llc_packet{
+	pbuf* pb;
+	uint8_t *data; //Start and length of the packet when it was queued
+	uint8_t len;
+	uint8_t dest; //Group address while the group transmission is out, then each receiver that missed it
+	uint8_t group; //Receivers of a group packet that have not ACKed it yet, 0 for one receiver
+	uint16_t limit; //Ticks it is resent for once its first frame is out, then given up, 0 = until ACKed
+}llc_packet;
+
+static llc_packet tx_queue[LLC_TX_QUEUE_SIZE]; //[tx_q_head] is the one being sent
+static uint8_t tx_q_head;
+static uint8_t tx_q_count;
+static uint8_t tx_frames; //Frames of the packet being sent
+static uint8_t all_frames; //Bitmap of them
+static uint8_t next_frame; //First frame not sent yet
+static timer ack_timer; //Runs while a packet is being sent, restarted by every frame queued
+static uint16_t tx_timeout; //ACK timeout of the packet being sent, longer for a group with its ACK slots
+static uint8_t tx_fec; //Packet being sent goes out in FEC frames
+static uint8_t tx_started; //First frame of the packet being sent is out, tx_deadline counts
+static uint16_t tx_deadline; //timer_now() the packet being sent is given up at
+#if STATS
+static uint16_t frame_queued[FRAMES_PER_PACKET]; //timer_now() when each frame was last queued
+static uint8_t frames_resent; //Bitmap of frames sent more than once, their ACK latency is not known
+#endif
 extern uint8_t DLL_ACK;
 
-ISR(TIMER1_COMPA_vect) { //Once Go-Back-N timeout runs out, checks whch frames have been acknowledged and then set resend frames not been acknowledged
+#define LLC_LINK_STATS (LLC_FEC == LLC_FEC_ADAPTIVE || RFM12_LINK_ADAPT) //Resends of the packet being sent are counted
 
-	 for(int i = ACK_frames; i<8;i++){
-			resend[i] = 1;
-		}
-		
-	return;
+#if LLC_LINK_STATS
+static uint8_t tx_sent; //Frames of the packet sent to the receiver it is sent to now, resends included
+static uint8_t tx_resent;
+#endif
+
+#if LLC_FEC == LLC_FEC_ADAPTIVE
+// Resends per link decide whether its packets go out with FEC. Once the share of frames resent
+// to the peer goes above LLC_FEC_ON, it is sent hold packets with FEC and then plain ones again
+// to see whether the link got better. A link that is lossy again soon after is held twice as long,
+// one FEC did not help (collisions, out of range) is left plain for LLC_FEC_HOLD_MAX packets.
+typedef struct llc_link{
+	uint8_t loss; //EWMA of the share of frames resent, of 255
+	uint8_t fec_loss; //loss at the end of the last FEC hold
+	uint8_t fec; //Packets still to be sent with FEC
+	uint8_t hold; //FEC packets the last time the link turned lossy
+	uint8_t plain; //Packets sent plain since then, saturates
+}llc_link;
+static llc_link links[ID_RANGE];
+#endif
+
+#if RFM12_LINK_ADAPT
+// Rate and power per peer. Packets with few resends count towards a faster rate, then a lower power,
+// while the peer is heard above the RSSI threshold. Many resends turn the power up first, then the rate
+// down, unless the signal is strong: those frames were lost to collisions, not to noise.
+typedef struct llc_radio{
+	uint8_t rate; //Rate level the frames after the first one of a packet go at
+	uint8_t power; //3 dB steps below full power of every frame to the peer
+	uint8_t clean; //Packets in a row sent with few resends
+	uint8_t rssi; //RSSI bit of the last frame from the peer
+}llc_radio;
+static llc_radio radios[ID_RANGE];
+static uint8_t tx_rate; //Rate level of the packet being sent, 0 for a single frame or a group
+static uint8_t tx_follow; //Receiver was told tx_rate and listens at it until it ACKs
+static uint8_t rx_follow = INF; //Sender this node was told to listen to at rx_rate until its ACK
+static uint8_t rx_rate;
+#endif
+
+static uint8_t count_bits(uint8_t bitmap){
+	uint8_t n = 0;
+	for(; bitmap; bitmap >>= 1)
+		n += bitmap & 1;
+	return n;
+}
+
+// Radio setting (MAC_SETTING()) of a frame to dest sent at rate level
+static uint8_t frame_setting(uint8_t dest, uint8_t rate){
+#if RFM12_LINK_ADAPT
+	if(dest < ID_RANGE)
+		return MAC_SETTING(rate, radios[dest].power);
+#endif
+	return 0;
+}
+
+#if RFM12_LINK_ADAPT
+// The receiver listens at the rate of the exchange it is in, else at the network rate
+static void listen(void){
+	listen_PHY(tx_follow ? tx_rate : rx_follow != INF ? rx_rate : 0);
+}
+#endif
+
+// Checksum and footer right behind the payload
+static void end_frame(Frame* f, uint16_t crc){
+	f->data[f->length] = crc >> 8;
+	f->data[f->length + 1] = crc & 0xff;
+	f->data[f->length + 2] = 0x7E; //Stop frame flag  01111110
 }
 
-void transmit_DLL(uint8_t *net_array, uint8_t DEST_address) {
+// Build frame number i of the packet straight into the transmit queue and send it
+// Frames are rebuilt from the packet buffer on every (re)send, so no per-frame copies are kept
+static void send_frame(uint8_t *net_array, uint8_t net_len, uint8_t i, uint8_t DEST_address){
+	uint8_t size = tx_fec ? FEC_DATA_SIZE : DATA_SIZE;
+	uint8_t offset = size*i;
+	uint8_t len = net_len - offset; //Bytes left for this and later frames
+	uint8_t *buf;
+	while(!(buf = tx_buffer_PHY())); //Wait for room in the transmit queue
 	
-//-----------------------FRAMING--------------------------//	
+	Frame* f = (Frame*) buf;
+	f->header = 0x7E;
+#if LLC_ARQ == LLC_SELECTIVE_REPEAT
+	f->control[0] = 0x80 | (tx_seq & 0x7F); //Send: data = 1sssssss ACK = 0sssssss
+#else
+	f->control[0] = 255; //Send: data = 11111111 ACK = 00000000 
+#endif
+	f->control[1] = i+1; //Frame number 1,2,3....
+	if(tx_fec)
+		f->control[1] |= FEC_FRAME;
+	uint8_t setting = frame_setting(DEST_address, 0);
+#if RFM12_LINK_ADAPT
+	f->control[1] |= tx_rate << FRAME_RATE_SHIFT;
+	if(tx_follow)
+		setting = frame_setting(DEST_address, tx_rate);
+#endif
+	f->SRC_address = ID;
+	f->DEST_address = DEST_address;
+	if(len <= size){
+		f->control[1] |= LAST_FRAGMENT;
+		f->length = len; //Payload bytes in last frame
+	}
+	else
+		f->length = size; //00010011
 	
-	put_str("In Transmit: \n\r");
+	uint16_t crc = crc16_block(CRC16_INIT, buf, offsetof(Frame, data)); //CRC runs along as the data is copied in
+	uint8_t frame_len = FRAME_LEN(f->length); //Last frame only as long as its payload
+#if LLC_FEC
+	if(tx_fec){ //CRC over the payload itself, payload and CRC sent as code bytes
+		for(uint8_t j = 0; j<f->length; j++){
+			uint8_t b = net_array[offset+j];
+			fec_encode(b, &f->data[2*j]);
+			crc = crc16_update(crc, b);
+		}
+		fec_encode(crc >> 8, &f->data[2*f->length]);
+		fec_encode(crc & 0xff, &f->data[2*f->length + 2]);
+		f->data[2*f->length + 4] = 0x7E;
+		frame_len = FEC_FRAME_LEN(f->length);
+	}
+	else
+#endif
+	{
+		for(uint8_t j = 0; j<f->length; j++){
+			uint8_t b = net_array[offset+j];
+			f->data[j] = b;
+			crc = crc16_update(crc, b);
+		}
+		end_frame(f, crc);
+	}
 	
+	while(transmit_PHY(frame_len, DEST_address, setting));
+	frames_sent |= 1<<i;
+	if(!tx_started){
+		tx_started = 1; //A packet waiting behind others is only timed once it is on air
+		tx_deadline = timer_now() + tx_queue[tx_q_head].limit;
+	}
+#if LLC_LINK_STATS
+	tx_sent++;
+#endif
+#if RFM12_LINK_ADAPT
+	if(tx_rate && !tx_follow){
+		tx_follow = 1; //Receiver knows the rate now, the ACK comes at it
+		listen();
+	}
+#endif
+	timer_start(&ack_timer, tx_timeout); //Timeout counts from the last frame queued
+#if STATS
+	frame_queued[i] = timer_now();
+#endif
+}
+
+// ACK built straight into the transmit queue, no payload: FRAME_LEN(0) bytes
+// control[0] holds the packet number with the top bit clear, control[1] the last frame received in order
+// (Go-Back-N) or the bitmap of frames received (selective repeat). 1 if the queue had no room.
+static uint8_t send_ack(uint8_t DEST_address, uint8_t ack, uint8_t seq){
+	uint8_t *ACK_array = tx_buffer_PHY();
+	if(!ACK_array)
+		return 1; //Queue still full of earlier ACKs, the next ACK covers this frame too and waiting would overrun the radio RX buffers
+	Frame* ACK_frame = (Frame*) ACK_array;
+
+	ACK_frame->header = 0x7E;
+	ACK_frame->control[0] = seq & 0x7F; //Packet the ACK belongs to
+	ACK_frame->control[1] = ack;
+	ACK_frame->SRC_address = ID;
+	ACK_frame->DEST_address = DEST_address;
+	ACK_frame->length = 0;
+	end_frame(ACK_frame, check_sum(ACK_frame));
+
+	uint8_t setting = frame_setting(DEST_address, 0);
+#if RFM12_LINK_ADAPT
+	if(rx_follow == DEST_address){ //ACK at the rate the sender listens at, the exchange ends with it
+		setting = frame_setting(DEST_address, rx_rate);
+		rx_follow = INF;
+		listen();
+	}
+#endif
+	while(transmit_PHY(FRAME_LEN(0), DEST_address, setting));
+	//put_str("ACK sent\n\r");
+	return 0;
+}
+
+// Delayed ACK, the frames of a burst are answered by one ACK once it pauses
+static timer ack_delay;
+static uint8_t ack_dest = INF; //Peer of the ACK waiting, INF if none
+static uint8_t ack_field;
+static uint8_t ack_seq;
+
+static void ack_flush(timer* t){
+	if(ack_dest == INF)
+		return;
+	if(send_ack(ack_dest, ack_field, ack_seq))
+		timer_start(&ack_delay, 1); //Transmit queue full, tried again on the next tick
+	else
+		ack_dest = INF;
+}
+
+// Ticks before the ACK of frame f goes out: none once it ends the burst, LLC_ACK_DELAY within it
+// The receivers of a group frame answer in turn, so their ACKs do not collide
+static uint16_t ack_after(Frame* f, uint8_t end){
+	if(!IS_GROUP(f->DEST_address))
+		return end ? 0 : LLC_ACK_DELAY;
+	uint8_t slot = count_bits(GROUP_MEMBERS(f->DEST_address) & ((1 << ID) - 1)); //Members before this one
+	return (slot + !end) * LLC_ACK_SLOT;
+}
+
+// ACK for a frame just received, wait ticks from now (ack_after())
+// Both ARQ modes ACK cumulatively, so the ACK waiting is replaced by the newer one
+static void ack_frame(uint8_t DEST_address, uint8_t ack, uint8_t seq, uint16_t wait){
+	if(wait && ack_dest == DEST_address && ack_field == ack && ack_seq == seq && timer_active(&ack_delay))
+		return; //Repeated frame, e.g. copies of a wake-up train, does not push back the ACK waiting for it
+	if(ack_dest != INF && ack_dest != DEST_address)
+		ack_flush(&ack_delay); //Burst of another peer, its ACK goes first
+	ack_dest = DEST_address;
+	ack_field = ack;
+	ack_seq = seq;
+	if(!wait){
+		timer_stop(&ack_delay);
+		ack_flush(&ack_delay);
+	}
+	else
+		timer_start(&ack_delay, wait);
+}
+
+// Send the packet at the head of the transmit queue from its first frame on
+static void start_frames(void){
+	next_frame = 0;
+	ACK_frames = 0;
+	frames_sent = 0;
+#if STATS
+	frames_resent = 0;
+#endif
+	for(uint8_t i = 0; i<8;i++){
+		resend[i] = 0;
+	}
+#if LLC_LINK_STATS
+	tx_sent = 0;
+	tx_resent = 0;
+#endif
+#if RFM12_LINK_ADAPT
+	llc_packet* q = &tx_queue[tx_q_head];
+	tx_rate = (!q->group && q->dest < ID_RANGE && tx_frames > 1) ? radios[q->dest].rate : 0;
+	tx_follow = 0;
+	listen();
+#endif
+	
+	timer_start(&ack_timer, tx_timeout);
+}
+
+#if LLC_FEC == LLC_FEC_ADAPTIVE
+// 1 if FEC is on for the link to dest, for a group for the link to any member
+static uint8_t link_fec(uint8_t dest){
+	if(IS_GROUP(dest)){
+		for(uint8_t i = 0; i < ID_RANGE; i++){
+			if(IN_GROUP(dest, i) && links[i].fec)
+				return 1;
+		}
+		return 0;
+	}
+	return dest < ID_RANGE && links[dest].fec;
+}
+
+// Packet to dest done with, its resends count for the link while it is plain
+static void link_update(uint8_t dest){
+	if(dest >= ID_RANGE)
+		return;
+	llc_link* l = &links[dest];
+	uint8_t share = tx_sent ? (uint16_t) tx_resent * 255 / tx_sent : 0;
+	l->loss = l->loss - l->loss / 8 + share / 8;
+	if(l->fec){
+		if(--l->fec == 0){
+			l->fec_loss = l->loss;
+			l->loss = 0; //Plain again, measured afresh
+			l->plain = 0;
+		}
+		return;
+	}
+	if(l->plain < 255)
+		l->plain++;
+	if(l->loss > LLC_FEC_ON){
+		if(l->fec_loss > LLC_FEC_ON && l->plain < LLC_FEC_HOLD_MAX)
+			return; //As lossy with FEC, the frames are lost whole
+		if(!l->hold || l->plain > l->hold)
+			l->hold = LLC_FEC_HOLD; //Was good for a while
+		else if(l->hold < LLC_FEC_HOLD_MAX / 2)
+			l->hold *= 2;
+		else
+			l->hold = LLC_FEC_HOLD_MAX;
+		l->fec = l->hold;
+		LOG_INFO("DLL - FEC on\n\r");
+	}
+}
+#endif
+
+#if RFM12_LINK_ADAPT
+// Packet to dest done with, rate and power of the link follow its resends
+static void radio_update(uint8_t dest){
+	if(dest >= ID_RANGE || tx_queue[tx_q_head].group)
+		return;
+	llc_radio* r = &radios[dest];
+	uint8_t share = tx_sent ? (uint16_t) tx_resent * 255 / tx_sent : 0;
+	if(share > LLC_RATE_DOWN){
+		r->clean = 0;
+		if(r->power)
+			r->power--;
+		else if(r->rate && !r->rssi)
+			r->rate--; //A strong signal loses frames to collisions, a slower rate would only make more
+	}
+	else if(share > LLC_RATE_DOWN / 4)
+		r->clean = 0;
+	else if(++r->clean >= LLC_RATE_UP && r->rssi){
+		r->clean = 0;
+		if(r->rate < MAC_RATES - 1)
+			r->rate++;
+		else if(r->power < LLC_POWER_STEPS)
+			r->power++;
+	}
+}
+#endif
+
+// Start sending the packet at the head of the transmit queue
+static void start_packet(void){
+	llc_packet* q = &tx_queue[tx_q_head];
 	
-	Frame f;
-	uint8_t dll_buffers[7][FRAME_SIZE];
-	uint8_t arrSize;
-	uint8_t ACK;
+//-----------------------FRAMING--------------------------//	
 	
-	f.header = 0x7E;
-	f.control[0] = 255; //Send: data = 11111111 ACK = 00000000 
-    f.SRC_address = ID; //GET VALUE FROM TOM
-    f.DEST_address = DEST_address; //GET VALUE FROM TOM
-    f.length = DATA_SIZE; //00010011 Fixed
-    f.footer = 0x7E; //Stop frame flag  01111110
+	LOG_DEBUG("In Transmit: \n\r");
 	
-	 for(uint8_t i = 0; i<7;i++){
-		 
-        f.control[1] = i+1; //Frame number 1,2,3....
-        
-        for(uint8_t j = 0; j<DATA_SIZE; j++){
-			
-            f.data[j] = net_array[(DATA_SIZE*i)+j];
-        }
-        check_sum(&f); //Calculate checksum and set in Frame
-//--------------Put into buffer array-----------------//		
-		dll_buffers[i][0] = f.header;
-		dll_buffers[i][1] = f.control[0];
-		dll_buffers[i][2] = f.control[1];
-		dll_buffers[i][3] = f.SRC_address;
-		dll_buffers[i][4] = f.DEST_address;
-		dll_buffers[i][5] = f.length;
-		for (int k = 0; k < DATA_SIZE; k++){
-			
-			dll_buffers[i][6+k] = f.data[k];
-			
-		}
-		dll_buffers[i][27] = f.checksum[0];
+#if LLC_FEC == LLC_FEC_ALWAYS
+	tx_fec = 1;
+#elif LLC_FEC == LLC_FEC_ADAPTIVE
+	tx_fec = link_fec(q->dest);
+#endif
+	if(q->len > FEC_DATA_SIZE * FRAMES_PER_PACKET)
+		tx_fec = 0; //Too long for FEC frames
+	uint8_t size = tx_fec ? FEC_DATA_SIZE : DATA_SIZE;
+	tx_frames = (q->len + size - 1) / size; //Only as many frames as the packet needs
+	if(tx_frames == 0)
+		tx_frames = 1;
+	if(tx_frames > FRAMES_PER_PACKET)
+		tx_frames = FRAMES_PER_PACKET;
+	all_frames = (1 << tx_frames) - 1;
 	
-		dll_buffers[i][28] = f.checksum[1];
-		dll_buffers[i][29] = f.footer;
+	tx_seq++;
+	tx_started = 0;
+	tx_timeout = LLC_TIMEOUT + count_bits(q->group) * LLC_ACK_SLOT; //Last receiver ACKs in the last slot
+	start_frames();
+}
+
+// Group packet the group transmission did not bring to every receiver: sent again to the first of
+// them on its own, under the same packet number so the frames it has already are kept
+static void next_receiver(void){
+	llc_packet* q = &tx_queue[tx_q_head];
+	uint8_t r = 0;
+	while(r < ID_RANGE - 1 && !(q->group & (1 << r)))
+		r++;
+	q->dest = r;
+	tx_timeout = LLC_TIMEOUT;
+	start_frames();
+}
+
+// Packet at the head of the queue is done with, acknowledged or given up
+static void end_packet(void){
+	timer_stop(&ack_timer);
+#if LLC_FEC == LLC_FEC_ADAPTIVE
+	link_update(tx_queue[tx_q_head].dest);
+#endif
+#if RFM12_LINK_ADAPT
+	radio_update(tx_queue[tx_q_head].dest);
+	tx_follow = 0;
+	listen();
+#endif
+	ACK_frames = 0;
+	pbuf_free(tx_queue[tx_q_head].pb);
+	tx_q_head = (tx_q_head + 1) % LLC_TX_QUEUE_SIZE;
+	tx_q_count--;
+	if(tx_q_count)
+		start_packet();
+}
+
+// Send whatever the window and the transmit queue allow, run on every event that may let the packet move on
+static void run_tx(void){
+	while(tx_q_count){
+		llc_packet* q = &tx_queue[tx_q_head];
 		
-		char text[40];
-		for(int k = 0; k < FRAME_SIZE; k++){	
-		sprintf(text, "%.2X", dll_buffers[i][k]);
-		//put_str(text);
+		uint8_t done = ACK_frames == all_frames;
+		if(IS_GROUP(q->dest))
+			done = !q->group; //Every receiver ACKed the group transmission
+		else if(done && q->group){
+			q->group &= ~(1 << q->dest);
+			if(q->group){
+				next_receiver(); //This receiver of the group packet has it now, on to the next
+				continue;
+			}
+		}
+		if(done){
+			LOG_INFO("DLL - All Frames Acknowledged!\n\r");
+			DLL_ACK = 1; //Let NET know DLL received all ACK's
+			end_packet();
+			continue;
 		}
-		put_str("\r\n");
 		
-		arrSize = sizeof(dll_buffers[i]);
-		while(transmit_PHY(dll_buffers[i], arrSize));
+		//Frames are only queued while there is room, so ACKs are still read in between
+		for(uint8_t j=0; j<FRAMES_PER_PACKET;j++){
+			if (resend[j] == 1 && tx_buffer_PHY()) {
+				resend[j] = 0; //Sent once per timeout
+				DLL_resends++;
+#if LLC_LINK_STATS
+				tx_resent++;
+#endif
+#if STATS
+				frames_resent |= 1<<j;
+#endif
+				send_frame(q->data, q->len, j, q->dest);
+			}
+		}
 		
+		//Keep up to LLC_WINDOW frames waiting for their ACK
+		while(next_frame < tx_frames && (IS_GROUP(q->dest) || count_bits(frames_sent & ~ACK_frames) < LLC_WINDOW) && tx_buffer_PHY()){
+			send_frame(q->data, q->len, next_frame, q->dest);
+			next_frame++;
+			LOG_DEBUG("\r\n");
+		}
+		return;
+	}
+}
+
+// Packets are queued and sent in the background, pb is held until the last frame is acknowledged
+void transmit_DLL(pbuf* pb, uint8_t DEST_address, uint16_t limit) {
+	if(tx_q_count == LLC_TX_QUEUE_SIZE){
+		LOG_ERROR("DLL - transmit queue full\n\r");
+		return; //Dropped, like a packet given up after its limit
 	}
 	
-	TIMSK1 |= _BV(OCIE1A); // start timer if timer runs out, interrupt code runs
-	while(ACK_frames != 7){ //Listen for ACK's
-		if(flLimit == 1 || ecLimit0 == 1 || ecLimit1 == 1 || ecLimit2 == 1){
-			flLimit = 0;
-			ecLimit0 = 0;
-			ecLimit1 = 0;
-			ecLimit2 = 0;
-			last_frame = 0;
-			//put_str("BREAK\n\n\n\r");
-			return;
-		}
-		ACK = receive_PHY();
-		char text[40];
-		sprintf(text, "ACK = %d\n\r", ACK);
-		//put_str(text);
-		if (ACK != 0){
-			ACK_frames = ACK;
-			for(int k = 0; k<ACK_frames;k++){
-				resend[k] = 0;
-			}
-		}		
-		
-		//sprintf(text, "Transmit_dll ACK'd frame: %d", ACK_frames);
-		//put_str(text);
-		//put_str("\n\r");
-		for(int j=0; j<7;j++){
-			if (resend[j] == 1) {
-				arrSize = sizeof(dll_buffers[j]);
-				while(transmit_PHY(dll_buffers[j], arrSize));
-			}
+	llc_packet* q = &tx_queue[(tx_q_head + tx_q_count) % LLC_TX_QUEUE_SIZE];
+	pbuf_ref(pb);
+	q->pb = pb;
+	q->data = pbuf_data(pb); //The caller may pull its header off again once this returns
+	q->len = pb->len;
+	q->dest = DEST_address;
+	q->group = IS_GROUP(DEST_address) ? GROUP_MEMBERS(DEST_address) : 0;
+	q->limit = limit;
+	tx_q_count++;
+	if(tx_q_count == 1)
+		start_packet();
+	run_tx();
+}
+
+static void ack_received(event* e){
+	if(!tx_q_count)
+		return;
+#if LLC_ARQ == LLC_SELECTIVE_REPEAT
+	uint8_t acked = e->arg & frames_sent;
+#else
+	uint8_t acked = ((1 << e->arg) - 1) & frames_sent; //Frames 1..ACK_no arrived in order
+#endif
+#if STATS
+	uint16_t now = timer_now();
+	for(uint8_t k = 0; k<FRAMES_PER_PACKET;k++){
+		if((acked & ~ACK_frames & ~frames_resent) & (1<<k))
+			STATS_TIME(ack_latency, now - frame_queued[k]);
+	}
+#endif
+	ACK_frames |= acked;
+	for(uint8_t k = 0; k<FRAMES_PER_PACKET;k++){
+		if(ACK_frames & (1<<k))
+			resend[k] = 0;
+	}
+	run_tx();
+}
+
+// ACK of src to the packet being sent, 1 if it counts for the frames sent to q->dest
+// Every receiver of a group packet ACKs it on its own, one that has it all is done with
+static uint8_t ack_from(uint8_t src, uint8_t field){
+	if(!tx_q_count || src >= ID_RANGE)
+		return 0;
+	llc_packet* q = &tx_queue[tx_q_head];
+#if LLC_ARQ == LLC_SELECTIVE_REPEAT
+	if((field & all_frames) == all_frames)
+#else
+	if(field >= tx_frames)
+#endif
+		q->group &= ~(1 << src);
+	return src == q->dest;
+}
+
+static void tx_event(event* e){
+	run_tx(); //Room in the transmit queue
+}
+
+// Once the timeout runs out, set resend for every frame sent but not acknowledged yet
+// The timer goes on running, frames lost again are resent every LLC_TIMEOUT until the packet is done with
+static void ack_timeout(timer* t){
+	if(tx_q_count && tx_started && tx_queue[tx_q_head].limit && (int16_t)(timer_now() - tx_deadline) >= 0){
+		LOG_INFO("DLL - packet given up\n\r");
+		last_frame = 0;
+		end_packet(); //Next hop out of reach, the packets behind it are not held up any longer
+		run_tx();
+		return;
+	}
+	if(tx_q_count && IS_GROUP(tx_queue[tx_q_head].dest)){
+		//The last ACK may have come in while its event waits behind this timeout, run_tx() ends the packet then
+		if(tx_queue[tx_q_head].group)
+			next_receiver(); //Receivers that missed the group transmission are sent the packet one by one
+		run_tx();
+		return;
+	}
+	timer_start(&ack_timer, tx_timeout);
+	for(uint8_t i = 0; i<FRAMES_PER_PACKET;i++){
+		if((frames_sent & ~ACK_frames) & (1<<i))
+			resend[i] = 1;
+	}
+#if RFM12_LINK_ADAPT
+	tx_follow = 0; //Receiver may not have heard the rate, the first frame resent tells it again
+	listen();
+#endif
+	run_tx();
+}
+
+// Called by the MAC for every copy of a wake-up train, the ACK only comes after the last one
+void restart_DLL_timer(void){
+	if(timer_active(&ack_timer))
+		timer_start(&ack_timer, tx_timeout);
+}
+
+static void frame_ready(event* e){
+	receive_PHY();
+}
+
+void init_DLL(void){
+	event_subscribe(EV_FRAME_READY, frame_ready);
+	event_subscribe(EV_ACK_RECEIVED, ack_received);
+	event_subscribe(EV_TX_READY, tx_event);
+	timer_setup(&ack_timer, ack_timeout, 0);
+	timer_setup(&ack_delay, ack_flush, 0);
+#if LLC_ARQ == LLC_SELECTIVE_REPEAT
+	sram_budget(SRAM_LLC, sizeof(rx_done));
+#endif
+	sram_budget(SRAM_LLC, sizeof(tx_queue));
+#if STATS
+	sram_budget(SRAM_LLC, sizeof(frame_queued));
+#endif
+#if LLC_FEC == LLC_FEC_ADAPTIVE
+	sram_budget(SRAM_LLC, sizeof(links));
+#endif
+#if RFM12_LINK_ADAPT
+	sram_budget(SRAM_LLC, sizeof(radios));
+#endif
+}
+
+// Hand the reassembled packet of len bytes to NET, the next one is reassembled in a fresh buffer while NET works on this one
+static void pass_packet(uint8_t len){
+	pbuf_trim(rx_pb, rx_pb->len - len);
+	LOG_INFO("DLL - Passed Packet to Network layer\n\r");
+	LOG_DEBUG_HEX(pbuf_data(rx_pb), rx_pb->len);
 	
+	pbuf* pb = rx_pb;
+	rx_pb = 0;
+	if(event_post(EV_PACKET_RECEIVED, 0, pb)) //Pass network packet to network layer
+		LOG_ERROR("DLL - event queue full, packet dropped\n\r");
+	pbuf_free(pb);
+}
+
+// Payload bytes in every frame of the packet f belongs to but the last
+static uint8_t frame_size(Frame* f){
+	return (f->control[1] & FEC_FRAME) ? FEC_DATA_SIZE : DATA_SIZE;
+}
+
+// Copy the payload of frame f into the packet being reassembled, 0 if no buffer is free
+static uint8_t store_frame(Frame* f){
+	if (!rx_pb){
+		rx_pb = pbuf_alloc(0);
+		if (!rx_pb)
+			return 0;
+		pbuf_put(rx_pb, NET_SIZE);
+	}
+	uint8_t size = frame_size(f);
+	uint8_t offset = size*((f->control[1] & FRAME_NUMBER)-1);
+	uint8_t *net_array = pbuf_data(rx_pb);
+	for(uint8_t i = 0; i<f->length && i<size && offset+i < NET_SIZE; i++){
+		net_array[offset+i] = f->data[i]; //Fill net_packet array with netork payload from frame
+	}
+	return 1;
+}
+
+#if LLC_ARQ == LLC_SELECTIVE_REPEAT
+// Frames are kept in any order, every ACK carries the bitmap of frames received so far.
+// One packet is reassembled at a time, the frames of other senders are not ACKed meanwhile
+// and come again after their timeout, unless its sender went quiet for LLC_RX_HOLD.
+static void receive_data(Frame* f){
+	static uint8_t rx_frames = 0; //Bitmap of frames received of the current packet, 0 once it went up
+	static uint8_t rx_last = 0; //Number of the last frame, 0 until it arrived
+	static uint8_t rx_len = 0; //Length of the packet, known with the last frame
+	static uint8_t rx_src = INF;
+	static uint8_t rx_seq = 0;
+	static uint16_t rx_heard; //timer_now() of the last frame of the current packet
+	
+	uint8_t frame_no = f->control[1] & FRAME_NUMBER;
+	uint8_t seq = f->control[0] & 0x7F;
+	uint8_t SRC_address = f->SRC_address;
+	if (frame_no < 1 || frame_no > FRAMES_PER_PACKET || SRC_address >= ID_RANGE)
+		return;
+	
+	if ((seq | 0x80) == rx_done[SRC_address]){ //Packet went up already, its ACK was lost
+		release_PHY();
+		ack_frame(SRC_address, 0xFF, seq, ack_after(f, 1));
+		return;
+	}
+	if (SRC_address != rx_src || seq != rx_seq){ //First frame of a new packet
+		if (rx_frames && SRC_address != rx_src && (uint16_t)(timer_now() - rx_heard) < LLC_RX_HOLD)
+			return; //Another sender is half way through its packet
+		rx_src = SRC_address;
+		rx_seq = seq;
+		rx_frames = 0;
+		rx_last = 0;
+	}
+	rx_heard = timer_now();
+	uint8_t ack_now = 1; //A frame that came again is ACKed at once, the ACK was lost
+	uint8_t complete = 0;
+	if (!(rx_frames & (1<<(frame_no-1)))){
+		if (!store_frame(f))
+			return; //No buffer free, don't ACK so frame is resent later
+		rx_frames |= 1<<(frame_no-1);
+		if (f->control[1] & LAST_FRAGMENT){
+			rx_last = frame_no;
+			uint8_t size = frame_size(f);
+			rx_len = size*(frame_no-1) + (f->length < size ? f->length : size);
 		}
+		complete = rx_last && rx_frames == (1 << rx_last) - 1;
+		if (complete && rx_len > NET_SIZE)
+			rx_len = NET_SIZE;
+		ack_now = rx_last != 0; //Last frame is in, the sender learns what is missing without waiting for its timeout
 	}
+	release_PHY(); //Frame consumed, radio buffer can take the next one
 	
-	put_str("DLL - All Frames Acknowledged!\n\r");
-	ACK_frames = 0;
-	DLL_ACK = 1; //Let NET know DLL received all ACK's
-	TIMSK1 &= ~_BV(OCIE1A);//if all acks arrived, diasble timer set ocie1a to 0
+	ack_frame(SRC_address, rx_frames, seq, ack_after(f, ack_now));
+	
+	if (complete){
+		rx_done[SRC_address] = seq | 0x80;
+		rx_frames = 0;
+		pass_packet(rx_len);
+	}
+}
+#else
+// Go-Back-N, only the next frame in order is kept
+static void receive_data(Frame* f){
+	uint8_t frame_no = f->control[1] & FRAME_NUMBER;
+	if (last_frame + 1 == frame_no){
+		if (!store_frame(f))
+			return; //No buffer free, don't ACK so frame is resent later
+		
+		uint8_t SRC_address = f->SRC_address;
+		uint8_t size = frame_size(f);
+		uint8_t len = size*(frame_no-1) + (f->length < size ? f->length : size);
+		uint8_t last = f->control[1] & LAST_FRAGMENT;
+		uint16_t wait = ack_after(f, last);
+		++last_frame;
+		release_PHY(); //Frame consumed, radio buffer can take the next one
+		
+		ack_frame(SRC_address, frame_no, 0, wait);
+		
+		if(last){ //Last fragment and all frames before it arrived in order (GO-BACK-N)
+			last_frame = 0;
+			pass_packet(len < NET_SIZE ? len : NET_SIZE);
+		}
+	}
+}
+#endif
+
+// crc was run over every byte of frame f as it came in. A FEC frame is decoded in place first,
+// a single bit error in any of its code bytes corrected, and its CRC run again over what it carried.
+static uint8_t frame_ok(Frame* f, uint16_t crc){
+#if LLC_FEC
+	if((f->control[0] & 0x80) && (f->control[1] & FEC_FRAME) && f->length <= FEC_DATA_SIZE){
+		uint8_t flags = 0;
+		for(uint8_t i = 0; i < f->length + 2; i++)
+			flags |= fec_decode(&f->data[2*i], &f->data[i]);
+		if((flags & FEC_FAILED) || crc16_block(CRC16_INIT, (uint8_t*) f, offsetof(Frame, data) + f->length + 2))
+			return 0;
+		if(flags & FEC_CORRECTED)
+			STATS_INC(llc_fec_corrected);
+		return 1;
+	}
+#endif
+	return crc == FRAME_CRC_RESIDUE;
 }
 
-uint8_t receive_DLL(uint8_t* recv_frame){
+uint8_t receive_DLL(uint8_t* recv_frame, uint16_t crc){
    
     //put_str("In Receive_dll:\n\r");
 	
-	char text[4];
-	//for (uint8_t i = 0; i < FRAME_SIZE; i++){
-		//sprintf(text, "%.2X", recv_frame[i]);
-		//put_str(text);
-	//}
-	//put_str("\n\r");
-   
-   
-	Frame f;
-	
-    static uint8_t net_array[NET_SIZE];
-    uint8_t ACK_array[FRAME_SIZE];
-    uint8_t arrSize;
-	uint8_t frame_ACK;
+	Frame* f = (Frame*) recv_frame; //Frame is parsed in place in the radio RX buffer
     
-    f.header = recv_frame[0];
-	if(f.header == 0x7E){
-        f.control[0] = recv_frame[1];
-        f.control[1] = recv_frame[2];
-        f.SRC_address = recv_frame[3];
-        f.DEST_address = recv_frame[4];
-        f.length = recv_frame[5];
-        for(uint8_t i = 0; i<FRAME_SIZE;i++){
-            f.data[i] = recv_frame[i+6];
-        }  
-
-        f.footer = recv_frame[29];
+	if(f->header == 0x7E && f->length <= DATA_SIZE){ //The CRC covers the length, a longer one is not ours
         
-        if (f.DEST_address != ID){ //Check if frame for this IlMatto
+        if (f->DEST_address != ID && !IN_GROUP(f->DEST_address, ID)){ //Check if frame for this IlMatto
             //put_str("DLL - Frame not for this IlMatto \n\r");
             return 0;
         } else {
             //put_str("DLL - Frame for this IlMatto\n\r");
-            check_sum(&f); //Calculate checksum of received frame
-            if (f.checksum[0] == recv_frame[27] && f.checksum[1] == recv_frame[28]){ //Check checksums match
+            if (frame_ok(f, crc)){ //CRC over the frame already run while it was received
+                heard_PHY(f->SRC_address);
+#if RFM12_LINK_ADAPT
+				if(f->SRC_address < ID_RANGE)
+					radios[f->SRC_address].rssi = rssi_PHY();
+#endif
                 //put_str("DLL - Checksums are the same\n\r");
         
-                if (f.control[0] == 0){ //Check if ACK frame
+                if (!(f->control[0] & 0x80)){ //Check if ACK frame
                     //put_str("DLL - Frame Received is ACK\n\r");
-                    
-					
-					char text[4];
-					sprintf(text, "DLL - ACK of Frame: %d", recv_frame[2]);
-					//put_str(text);
-					put_str("\n\r");
-					return recv_frame[2];
+#if LLC_ARQ == LLC_SELECTIVE_REPEAT
+					if (f->control[0] != (tx_seq & 0x7F))
+						return 0; //Late ACK of an earlier packet
+#endif
+					LOG_DEBUG("\n\r");
+					uint8_t ack = f->control[1];
+					if(!ack_from(f->SRC_address, ack))
+						ack = 0; //ACK of another receiver of a group packet, only runs the sender on
+#if RFM12_LINK_ADAPT
+					else if(tx_follow){
+						tx_follow = 0; //Receiver is back at the network rate
+						listen();
+					}
+#endif
+					event_post(EV_ACK_RECEIVED, ack, 0);
+					return ack;
                 } else { //Frame is DATA
                     //put_str("DLL - Frame Received is DATA\n\r");
-                    
-					if (last_frame + 1 == f.control[1]){
-						++last_frame;
-						 //Send ACK
-						Frame ACK;
-                    
-						ACK.header = 0x7E;
-						ACK.control[0] = 0;
-						ACK.control[1] = f.control[1];
-						ACK.SRC_address = ID;
-						ACK.DEST_address = f.SRC_address;
-						ACK.length = DATA_SIZE;
-						for(uint8_t i = 0; i<21;i++){
-							ACK.data[i] = 0;
-						}
-						check_sum(&ACK);
-						ACK.footer = 0x7E;
-						
-						ACK_array[0] = ACK.header;
-						ACK_array[1] = ACK.control[0];
-						ACK_array[2] = ACK.control[1];
-						ACK_array[3] = ACK.SRC_address;
-						ACK_array[4] = ACK.DEST_address;
-						ACK_array[5] = ACK.length;
-						for (int k = 0; k < 21; k++){
-				
-							ACK_array[6+k] = ACK.data[k];
-				
-						}
-						ACK_array[27] = ACK.checksum[0];
-			
-						ACK_array[28] = ACK.checksum[1];
-						ACK_array[29] = ACK.footer;
-			
-						arrSize = sizeof(ACK_array);
-						while(transmit_PHY(ACK_array, arrSize));
-						//put_str("ACK sent\n\r");
-						
-                    
-						for(uint8_t i = 0; i<f.length; i++){
-							if(f.control[1] == 1){
-								net_array[i] = f.data[i];
-							} else {
-								net_array[(DATA_SIZE*(f.control[1]-1))+i] = f.data[i]; //Fill net_packet array with netork payload from frame
-							}
-	
-								
-							
-						}
-						
-						
-						if(f.control[1] == 7 && last_frame == 7){ //Check if last frame in packet and all 6 frames are correct (GO-BACK-N)
-							last_frame = 0;
-							put_str("DLL - Passed Packet to Network layer\n\r");
-							
-							for(int k = 0; k<NET_SIZE; k++){	
-								sprintf(text, "%.2X", net_array[k]);
-								put_str(text);
-							}
-							put_str("\r\n");
-							
-							receive_NET(net_array); //Pass network packet to network layer
-						}
+#if RFM12_LINK_ADAPT
+					if(f->DEST_address == ID && (f->control[1] & FRAME_RATE)){
+						rx_follow = f->SRC_address; //Rest of the packet comes at this rate, the ACK goes at it
+						rx_rate = (f->control[1] & FRAME_RATE) >> FRAME_RATE_SHIFT;
+						listen();
 					}
+#endif
+                    receive_data(f);
                    return 0;
                 }
                 
             } else {
                 //put_str(" DLL - Checksums not the same\n");
+                STATS_INC(llc_crc_errors);
 				return 0;
                 //Don't send ACK
             }
@@ -244,39 +784,11 @@ uint8_t receive_DLL(uint8_t* recv_frame){
 	}else{
 		//put_str("DLL - Received Frame not got header 0x7E");
 	}
+	return 0;
 }
 
-void check_sum(Frame* f) { //Calculate sum of nibbles of each byte in checksum
-    
-    uint16_t sum = 0; //2 BYTE SUM
-    uint8_t nibbles[52]; //52 nibbles in frame (includes: control[1], control[2], SRC_address, DEST_address, Length, 21bytes of DATA)
-
-    nibbles[0] = f->control[0] & 0x0F; //Get Least Significant nibble of Byte
-    nibbles[1] = ((f->control[0] & 0xF0) >> 4); //Get Most Significant nibble of Byte
-    nibbles[2] = f->control[1] & 0x0F;
-    nibbles[3] = ((f->control[1] & 0xF0) >> 4);
-    nibbles[4] = f->SRC_address & 0x0F;
-    nibbles[5] = ((f->SRC_address & 0xF0) >> 4);
-    nibbles[6] = f->DEST_address & 0x0F;
-    nibbles[7] = ((f->DEST_address & 0xF0) >> 4);
-    nibbles[8] = f->length & 0x0F;
-    nibbles[9] = ((f->length & 0xF0) >> 4);
-    int j = 0;
-    for (int i = 10; i<52;i++){
-        nibbles[i] = f->data[j] & 0x0F;
-        i++;
-        nibbles[i] = ((f->data[j] & 0xF0) >> 4);
-        j++;
-    }
-    
-    for (int i = 0;i<52;i++){
-        
-        sum = sum + nibbles[i]; //Add all nibbles together and store in sum
-    }
-    
-    f->checksum[0] = sum & 0xff; //Allocate Least Significant BYTE of sum to BYTE 0 of checksum 
-    f->checksum[1] =(sum >> 8);	//Allocate MOST Significant BYTE of sum to BYTE 1 of checksum 
-    
-    return;
+uint16_t check_sum(Frame* f) { //CRC-16 over header, control, addresses, length and data
+
+    return crc16_block(CRC16_INIT, (uint8_t*) f, offsetof(Frame, data) + f->length); //MSB goes in the first byte behind the data, LSB in the second
     
-}
\ No newline at end of file
+}
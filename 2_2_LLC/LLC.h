@@ -4,15 +4,80 @@
 #include <util/delay.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <avr/interrupt.h>
-#include "../PHY/PHY.h"
-#include "../NET/NET.h"
+#include "../common/pbuf.h"
+#include "../common/crc16.h"
+#include "../common/fec.h"
+#include "../common/event.h"
+#include "../common/timer.h"
+#include "../common/stats.h"
+#include "../common/sram.h"
+#include "../common/group.h"
+#include "../1_PHY/PHY.h"
+#include "../3_NET/NET.h"
 
 #define NET_SIZE 128
-#define DATA_SIZE 21
-#define FRAME_SIZE 30
+#define FRAME_SIZE RFM12_TX_BUFFER_SIZE //Longest frame, 30 or 140 with RFM12_LONG_PACKETS (rfm12_config.h)
+#define FRAME_OVERHEAD 9 //header, control, addresses, length, checksum and footer
+#define FRAME_LEN(data_len) ((data_len) + FRAME_OVERHEAD) //Bytes sent for a frame carrying data_len payload bytes
+#define DATA_SIZE (FRAME_SIZE - FRAME_OVERHEAD) //Most payload bytes in a frame, 21 or 131
 #define F_CPU 12000000
 #define PRESCALER 1024
+#define FRAMES_PER_PACKET ((NET_SIZE + DATA_SIZE - 1) / DATA_SIZE) //Most frames a packet is split into, 7 or 1, at most 8
+#define FRAME_NUMBER 0x0F   //control[1] of a data frame: frame number 1,2,3....
+#define FRAME_RATE 0x30     //rate level the sender goes on at after this frame, the receiver follows until it ACKs
+#define FRAME_RATE_SHIFT 4
+#define FEC_FRAME 0x40      //flag on every frame of a packet sent with FEC
+#define LAST_FRAGMENT 0x80  //and flag on the last frame of the packet, length holds its payload bytes
+#define FRAME_CRC_RESIDUE 0x9F59 //CRC-16 over a whole error free frame: 0 after the checksum, then the footer 0x7E
+#define FEC_FRAME_LEN(data_len) (2*(data_len) + FRAME_OVERHEAD + 2) //Payload and checksum sent as two code bytes each
+#define FEC_DATA_SIZE ((FRAME_SIZE - FRAME_OVERHEAD - 2) / 2) //Most payload bytes in a FEC frame, 9 or 64
+
+// ARQ modes, the receiver and sender of a link must use the same one
+#define LLC_GO_BACK_N 0         // ACK carries last frame received in order, frames out of order are dropped
+#define LLC_SELECTIVE_REPEAT 1  // ACK carries bitmap of frames received, only missing frames are resent
+
+#define LLC_TX_QUEUE_SIZE 4     // Packets waiting for the link, each holds a pbuf reference
+#if RFM12_LINK_ADAPT
+#define LLC_TIMEOUT TIMER_MS(84)    // Frames take three times as long at the lower network rate
+#else
+#define LLC_TIMEOUT TIMER_MS(28)    // No ACK for this long after the last frame queued, unacknowledged frames are resent
+#endif
+
+#ifndef LLC_ARQ
+#define LLC_ARQ LLC_SELECTIVE_REPEAT
+#endif
+#ifndef LLC_ACK_DELAY_MS
+#define LLC_ACK_DELAY_MS 10     // 0 = every data frame ACKed at once, else one cumulative ACK once a burst has paused this long
+#endif
+#define LLC_ACK_DELAY TIMER_MS(LLC_ACK_DELAY_MS)
+#ifndef LLC_ACK_SLOT_MS
+#define LLC_ACK_SLOT_MS 4       // Receivers of a group frame ACK in turn, one slot each in the order of their IDs
+#endif
+#define LLC_ACK_SLOT TIMER_MS(LLC_ACK_SLOT_MS)
+
+// Forward error correction of payload and checksum (common/fec.h), every node must be built the same way
+// The header is sent as it is, a FEC frame only carries packets that fit into FRAMES_PER_PACKET of them
+#define LLC_FEC_OFF 0           // Plain frames only
+#define LLC_FEC_ADAPTIVE 1      // Per link, frames carry FEC while the sender has to resend many of them to the peer
+#define LLC_FEC_ALWAYS 2
+#ifndef LLC_FEC
+#define LLC_FEC LLC_FEC_ADAPTIVE
+#endif
+#define LLC_FEC_ON 64           // Share of frames resent to a peer, of 255, that turns FEC on for its link
+#define LLC_FEC_HOLD 16         // Packets sent with FEC before the link is tried plain again
+#define LLC_FEC_HOLD_MAX 128    // Hold limit, doubled each time the link is lossy again soon after
+
+// Link adaptation (RFM12_LINK_ADAPT in rfm12lib/rfm12_config.h), rate and power per peer from the resends of its packets
+// The first frame of a packet or of a resend goes at the network rate and tells the receiver the rate of the rest and of its ACK
+#define LLC_RATE_UP 8           // Packets in a row with few resends (LLC_RATE_DOWN / 4) and a strong signal back before the link is tried one level faster, at the top one power step lower
+#define LLC_RATE_DOWN 64        // Share of frames resent, of 255, that makes the link one power step louder, at full power and with a weak signal one level slower
+#define LLC_POWER_STEPS 3       // Most 3 dB steps the power is turned down by
+#ifndef LLC_WINDOW
+#define LLC_WINDOW 7            // Frames sent but not yet acknowledged, 1..FRAMES_PER_PACKET
+#endif
+#define LLC_RX_HOLD (4 * LLC_TIMEOUT) // Unfinished packet of one sender holds off the frames of others for this long after its last frame
 
 
 typedef struct Frame
@@ -22,19 +87,21 @@ typedef struct Frame
     uint8_t SRC_address;
     uint8_t DEST_address;
     uint8_t length;
-    uint8_t data[DATA_SIZE];
-    uint8_t checksum[2];
-    uint8_t footer;
+    uint8_t data[DATA_SIZE + 3];    // length payload bytes, then checksum MSB first and footer
     
-}Frame;
+}Frame;                     // Sent as FRAME_LEN(length) bytes, the checksum is the CRC-16 of header .. data
 
 extern uint8_t last_frame; //Last frame recevied by DLL
 extern volatile uint8_t resend[8]; //Store which frames have been re-sent
-extern volatile uint8_t ACK_frames; //Store which frames have been acknowledged
+extern volatile uint8_t ACK_frames; //Bitmap of frames acknowledged, bit i = frame i+1
+extern uint16_t DLL_resends; //Frames sent again after an ACK timeout
 
 
-void transmit_DLL(uint8_t *net_array, uint8_t DEST_address);
-uint8_t receive_DLL(uint8_t *recv_frame);
-void check_sum(Frame* f);
+void init_DLL(void);
+void transmit_DLL(pbuf* pb, uint8_t DEST_address, uint16_t limit); // Queue packet, returns at once. DEST_address may be a group (common/group.h),
+                                                        // limit: ticks it is resent for once its first frame is out, 0 = until ACKed
+uint8_t receive_DLL(uint8_t *recv_frame, uint16_t crc); // crc: CRC-16 run over every byte received
+uint16_t check_sum(Frame* f);                           // CRC-16 of header .. data[length - 1]
+void restart_DLL_timer(void);                           // ACK timeout counts from now, if a packet is being sent
 
 #endif
\ No newline at end of file
@@ -1,175 +1,355 @@
 #include "NET.h"
 
-volatile uint16_t flCount;
-volatile uint8_t flLimit;
-
-volatile uint16_t ecCount0;
-volatile uint16_t ecCount1;
-volatile uint16_t ecCount2;
-volatile uint8_t ecLimit0;
-volatile uint8_t ecLimit1;
-volatile uint8_t ecLimit2;
+volatile uint16_t netTicks;
 uint8_t DLL_ACK;
 volatile uint8_t distanceTable[ID_RANGE][ID_RANGE];  // Routing Table Store Distance to each Element
 
+// Next hop towards every destination, INF if unreachable. Rebuilt by update_routes()
+// whenever an echo ACK changes distanceTable, so forwarding is a single lookup.
+static uint8_t nextHop[ID_RANGE];
+static void update_routes(void);
+
+// Flooded packets already seen, replaced oldest first
+typedef struct flood_entry{
+	uint8_t SRCadd;
+	uint8_t seq;
+}flood_entry;
+static flood_entry floodSeen[FLOOD_CACHE_SIZE];
+static uint8_t floodNext;
+
+// Echo round trip per neighbour, timed against netTicks. One timer runs to the
+// earliest deadline of all outstanding echoes, so its cost does not grow with ID_RANGE.
+// Link cost is an EWMA of the round trip. A link that keeps its cost is probed less and
+// less often, one that changes, times out or makes DLL resend is probed again soon.
+typedef struct neighbour{
+	uint16_t echoSent;          // netTicks when the last echo was sent
+	uint16_t nextProbe;         // netTicks when the link is due to be probed again
+	uint16_t interval;          // Between probes, ECHO_MIN_INTERVAL .. ECHO_MAX_INTERVAL
+	uint16_t rtt;               // EWMA of the round trip in NET ticks, times 8, 0 = no sample yet
+	uint8_t misses;             // Echoes in a row that timed out
+}neighbour;
+static neighbour neighbours[ID_RANGE];
+static uint8_t echoWaiting[(ID_RANGE + 7) / 8]; // Bit per neighbour, echo not answered yet
+static timer echoTimer;                         // Runs to the earliest echo deadline
+static timer probeTimer;                        // Runs to the next probe due, a node that only forwards probes as well
+static uint8_t routeDist[ID_RANGE];             // Distance vector of this Ill Matto, sent in echo ACKs
+static uint16_t probeSeed;                      // Jitters probe times, nodes started together do not probe in lockstep
+
+// Checksum written by this hop behind the TRAN segment, none unless the integrity policy wants NET checked
+static inline void net_seal(Packet* p){
+#if NET_CHECK
+    uint16_t par = parCheck(p);
+#else
+    uint16_t par = 0;
+#endif
+    uint8_t* trailer = net_trailer(p);
+    trailer[0] = par >> 8;
+    trailer[1] = par;
+}
 
-ISR(TIMER2_COMPA_vect){
-	
-	if(ROUTING == FLOODING){
-		flCount++;
-		if(flCount == 500){
-			flLimit = 1;
-			flCount = 0;
-			put_str("Next flood ID\n\r");								
+static inline uint8_t net_verify(Packet* p){
+#if NET_CHECK
+    uint8_t* trailer = net_trailer(p);
+    return parCheck(p) == (((uint16_t) trailer[0] << 8) | trailer[1]);
+#else
+    return 1; // Frames already passed the LLC CRC
+#endif
+}
+
+
+// NET clock, every ~10ms from the MAC tick on TIMER2
+void tick_NET(void){
+	netTicks++;
+}
+
+static void expire_echoes(void);
+static void arm_echo_timer(void);
+static void arm_probe_timer(void);
+static void probe_timeout(timer* t);
+
+static void echo_timeout(timer* t){
+	expire_echoes();                        // DLL gave up the echo on its own, see passPacket()
+	arm_echo_timer();
+	arm_probe_timer();                      // Links that timed out are due again
+}
+
+
+// NET ticks an echo to i waits for its ACK, short for a node not known as neighbour, DLL sent it once only
+static uint16_t echo_wait(uint8_t i){
+	return (distanceTable[ID][i] != INF) ? ECHO_TIMEOUT : ECHO_FIND_WAIT;
+}
+
+// Earliest deadline of the echoes still waiting for their ACK
+static void arm_echo_timer(void){
+	uint8_t armed = 0;
+	uint16_t minLeft = 0;
+	uint16_t now = netTicks;
+	for(uint8_t i = 0; i < ID_RANGE; i++){
+		if(!(echoWaiting[i / 8] & (1 << (i % 8))))
+			continue;
+		uint16_t age = now - neighbours[i].echoSent;
+		uint16_t wait = echo_wait(i);
+		if(age >= wait)
+			continue;                       // Timed out already
+		if(!armed || (wait - age < minLeft)){
+			minLeft = wait - age;
+			armed = 1;
 		}
-	}	
-	
-	if(ROUTING == DISTVEC){
-		ecCount0++;
-		ecCount1++;
-		ecCount2++;		
-		
-		if(ecCount0 == 1000)
-			if(ID != 0)
-				ecLimit0 = 1;			
-		
-		if(ecCount1 == 1000)
-			if(ID != 1)
-				ecLimit1 = 1;				
-		
-		if(ecCount2 == 1000)
-			if(ID != 2)
-				ecLimit2 = 1;			
-	}		
+	}
+	if(armed)
+		timer_start(&echoTimer, minLeft * NET_TICK_DIV);
+	else
+		timer_stop(&echoTimer);
+}
+
+
+//xorshift, every node starts from its own seed
+static uint16_t net_rand(void){
+	probeSeed ^= probeSeed << 7;
+	probeSeed ^= probeSeed >> 9;
+	probeSeed ^= probeSeed << 8;
+	return probeSeed;
+}
+
+// Probe the link soon and then back off again from the shortest interval
+static void reprobe(uint8_t i){
+	neighbours[i].interval = ECHO_MIN_INTERVAL;
+	neighbours[i].nextProbe = netTicks;
+}
+
+// Next probe after the current interval, doubled while the link stays as it was
+static void schedule_probe(uint8_t i, uint8_t stable){
+	if(!stable)
+		neighbours[i].interval = ECHO_MIN_INTERVAL;
+	else if(neighbours[i].interval < ECHO_MAX_INTERVAL / 2)
+		neighbours[i].interval *= 2;
+	else
+		neighbours[i].interval = ECHO_MAX_INTERVAL;
+	neighbours[i].nextProbe = netTicks + neighbours[i].interval + net_rand() % ECHO_JITTER;
 }
 
+// Earliest probe due of the links not waiting for an echo ACK, ECHO_SPACING from now at the soonest
+static void arm_probe_timer(void){
+	uint8_t armed = 0;
+	int16_t minLeft = 0;
+	for(uint8_t i = 0; i < ID_RANGE; i++){
+		if((i == ID) || (echoWaiting[i / 8] & (1 << (i % 8))))
+			continue;
+		int16_t left = neighbours[i].nextProbe - netTicks;
+		if(!armed || (left < minLeft)){
+			minLeft = left;
+			armed = 1;
+		}
+	}
+	if(!armed){
+		timer_stop(&probeTimer);            // Every link waits for its ACK, the echo timer arms it again
+		return;
+	}
+	if(minLeft < ECHO_SPACING)
+		minLeft = ECHO_SPACING;
+	uint16_t ticks = (minLeft > TIMER_MAX / NET_TICK_DIV) ? TIMER_MAX : minLeft * NET_TICK_DIV;
+	if(!timer_active(&probeTimer) || (timer_left(&probeTimer) > ticks))
+		timer_start(&probeTimer, ticks);
+}
 
-void transmit_NET(uint8_t TRANsegment[], uint8_t DESTaddr){
-    Packet p;
-    static int echoCount = 0;
+// Echoes not answered within echo_wait(), after ECHO_MISSES of them the link is gone.
+// A single one is often just a packet DLL had no room for.
+static void expire_echoes(void){
+	uint8_t changed = 0;
+	for(uint8_t i = 0; i < ID_RANGE; i++){
+		if(!(echoWaiting[i / 8] & (1 << (i % 8))) || ((uint16_t)(netTicks - neighbours[i].echoSent) < echo_wait(i)))
+			continue;
+		echoWaiting[i / 8] &= ~(1 << (i % 8));
+		schedule_probe(i, distanceTable[ID][i] == INF);  // Backs off from a link that stays down
+		if(neighbours[i].misses < ECHO_MISSES)
+			neighbours[i].misses++;
+		if((neighbours[i].misses == ECHO_MISSES) && (distanceTable[ID][i] != INF)){
+			neighbours[i].rtt = 0;
+			distanceTable[ID][i] = INF;
+			changed = 1;
+		}
+	}
+	if(changed)
+		update_routes();
+}
+
+void transmit_NET(pbuf* pb, uint8_t DESTaddr){
+    static uint16_t lastResends = 0;
+    static uint16_t resendAvg = ECHO_RESEND_SPIKE * 8;
+    static uint8_t seq = 0;
+    uint8_t length = NET_MIN_SIZE + pb->len;
+    
+    // Header and checksum written in place around the Transport Segment passed from Transport Layer
+    Packet* p = (Packet*) pbuf_push(pb, NET_HEADER_SIZE);
+    pbuf_put(pb, NET_TRAILER_SIZE);
  
-	p.control[0] = 0;                  // Control indicates parity check && send message from TRAN to DLL  
-    p.control[1] = 0;                  // Set Second byte of control un-used
-    p.SRCadd = ID;                  // Source Address = Address of this Ill Matto
-    p.length = NET_SIZE;               // Fixed Length of Packet size
-	p.DESTadd = DESTaddr;               // Destination Address passed from Transport Layer
-	for(int i = 0; i < TRAN_SIZE; i++)  // Transport Segment passed from Transport Layer
-		p.TRANseg[i] = TRANsegment[i];  
+	p->control[0] = 0;                  // Control indicates parity check && send message from TRAN to DLL  
+    p->control[1] = 0;                  // Set Second byte of control un-used
+    p->SRCadd = ID;                  // Source Address = Address of this Ill Matto
+    p->length = length;                 // Only as long as the TRAN segment needs
+	p->DESTadd = DESTaddr;               // Destination Address passed from Transport Layer
+	p->seq = seq++;                      // Tells repeats of a flooded packet apart from new ones
      
 
 	if(ROUTING == DISTVEC){
-		// if echo count reach 10 iterations, send echo call to all neighbours
-		if(echoCount == 0){
-			p.control[0] = 2;                    // control indicates parity check && sending echo
-			
-			put_str("Send ECHO broadcast\n\n\r");
-
-			int i = 1;
-				if(ID != i){
-					echo(&p,i);	
-				}
-			}			
-			echoCount = 10;                         // Reset echo count
+		// DLL resends some frames of most packets, only a jump well above the usual
+		// number means a link got worse and every link is probed again soon
+		uint16_t resends = DLL_resends - lastResends;
+		if(resends > 255)
+			resends = 255;
+		lastResends = DLL_resends;
+		if(resends * 8 > 2 * resendAvg + ECHO_RESEND_SPIKE * 8){
+			for(uint8_t i = 0; i < ID_RANGE; i++)
+				reprobe(i);
+			arm_probe_timer();
 		}
+		resendAvg = resendAvg - resendAvg / 8 + resends;   // EWMA times 8, 1/8 weight
+
+		net_seal(p);
+		distVec(pb);							// Next hop from the route cache
+	}
 
-		else{                                      // Transmit message from TRAN to DLL  		
-			echoCount--; 
-		}
-		p.control[0] = 0;                       // control indicates parity check && sending echo
-		p.checksum = parCheck(&p);
-		//distVec(&p);							// Call Distance Vector Routing Algorithm
-  
-	
-	
 	// Calculate Hop Destination Address via pre-determined Routing Algorithm
 	if(ROUTING == FLOODING){
-		p.control[1] = ID_RANGE - 1; // Set hop limit
-		flooding(&p);                // Call Flooding Routing Algorithm
+		p->control[1] = ID_RANGE - 1; // Set hop limit
+		flooding(pb);                // Call Flooding Routing Algorithm
 	}            
 
+	// Hand the segment back to TRAN as it was passed down
+	pbuf_trim(pb, NET_TRAILER_SIZE);
+	pbuf_pull(pb, NET_HEADER_SIZE);
 }
 
 
 
-void receive_NET(uint8_t DLLpacket[]){
+// Row src of the table is the distance vector last received from src, 1 if it changed
+static uint8_t merge_vector(uint8_t src, uint8_t* vector){
+	uint8_t changed = 0;
+	for(uint8_t j = 0; j < ID_RANGE; j++){
+		if(distanceTable[src][j] != vector[j]){
+			distanceTable[src][j] = vector[j];
+			changed = 1;
+		}
+	}
+	return changed;
+}
 
-    Packet p;
-    uint8_t NETpacket[NET_SIZE];
+static void packet_received(event* e){
+	receive_NET(e->pb);
+}
 
-    // Decode array to packet
-    p.control[0] = DLLpacket[0];
-    p.control[1] = DLLpacket[1];
-    p.SRCadd = DLLpacket[2];
-    p.DESTadd = DLLpacket[3];
-    p.length = DLLpacket[4];
-    for(int i = 5; i < 5 + TRAN_SIZE; i++)
-        p.TRANseg[i-5] = DLLpacket[i];
-    p.checksum = DLLpacket[126] + (DLLpacket[127] << 8);     
+void init_NET(void){
+	event_subscribe(EV_PACKET_RECEIVED, packet_received);
+	for(uint8_t j = 0; j < ID_RANGE; j++){
+		for(uint8_t i = 0; i < ID_RANGE; i++)
+			distanceTable[i][j] = ((i == ID) && (j == ID)) ? 0 : INF;
+	}
+	for(uint8_t i = 0; i < (ID_RANGE + 7) / 8; i++)
+		echoWaiting[i] = 0;
+	probeSeed = 0xACE1 ^ (ID * 0x0101);
+	for(uint8_t i = 0; i < ID_RANGE; i++){
+		neighbours[i].rtt = 0;
+		neighbours[i].misses = 0;
+		neighbours[i].interval = ECHO_MIN_INTERVAL;
+		neighbours[i].nextProbe = net_rand() % ECHO_JITTER;
+		routeDist[i] = (i == ID) ? 0 : INF;
+	}
+	timer_setup(&echoTimer, echo_timeout, 0);
+	timer_setup(&probeTimer, probe_timeout, 0);
+	for(uint8_t i = 0; i < FLOOD_CACHE_SIZE; i++)
+		floodSeen[i].SRCadd = INF;          // Matches no Ill Matto
+	for(uint8_t i = 0; i < ID_RANGE; i++)
+		nextHop[i] = INF;                   // Nothing reachable before the first echo ACK
+	if(ROUTING == DISTVEC)
+		arm_probe_timer();                  // Every node is probed once at start to find the neighbours
+	sram_budget(SRAM_NET, sizeof(distanceTable) + sizeof(nextHop) + sizeof(floodSeen)
+			+ sizeof(neighbours) + sizeof(echoWaiting) + sizeof(routeDist));
+}
+
+
+void receive_NET(pbuf* pb){
+
+    // Decode packet in place in the buffer reassembled by DLL
+    Packet* p = (Packet*) pbuf_data(pb);
+    if((pb->len < NET_MIN_SIZE) || (p->length < NET_MIN_SIZE) || (p->length > pb->len)){
+		LOG_ERROR("Length: FAIL\n\r");
+		STATS_INC(net_errors);
+		return;
+    }
+    pbuf_trim(pb, pb->len - p->length);   // Nothing behind the checksum is part of the packet
       
 
-	if(parCheck(&p) == p.checksum){
+	if(net_verify(p)){
 		
-		put_str("\n\rParity Check: PASS\n\r");
+		LOG_DEBUG("Parity Check: PASS\n\r");
 		
-		if(p.control[0] == 0){                 // Received normal packet     
+		if(p->control[0] == 0){                 // Received normal packet     
 
-			if(ROUTING == FLOODING)            // Determine routing type to forward packet
-				flooding(&p);
+			if(ROUTING == FLOODING){           // Determine routing type to forward packet
+				if((p->SRCadd == ID) || flood_seen(p)){
+					LOG_DEBUG("Flooded packet seen: DROP\n\r");
+					return;
+				}
+				flooding(pb);
+			}
 			if(ROUTING == DISTVEC) 
-				distVec(&p);                   
+				distVec(pb);                   
 			
 		}
 
 		// Received echo call, send back echo acknowledgment and distance table
-		if(p.control[0] == 2){              
-            put_str("\n\rReceived ECHO\n\r");		
-			p.control[0] = 4;                 // Set control to parity check, echo acknowledgment and distance table
-			p.DESTadd = p.SRCadd;             // Set destination to source of received packet
-			p.SRCadd = ID;                 // Source is now ID of this ill matto
-			p.length = NET_SIZE;              // Fixed size packet
-
-			// Convert distance table matrix to array and fill TRAN segment
-			int k = 0;
-			for(int j = 0; j < ID_RANGE; j++){
-				for(int i = 0; i < ID_RANGE; i++){
-					p.TRANseg[k] = distanceTable[i][j];
-					k++;
+		if((p->control[0] == 2) && (p->length >= ECHO_SIZE)){
+            LOG_INFO("Received ECHO\n\r");		
+			// The echo carries the distance vector of its sender as well, so both ends
+			// learn from one probe. Its distance to us stands in for the link cost
+			// until this Ill Matto measured the link itself.
+			if(p->SRCadd < ID_RANGE){
+				if(distanceTable[ID][p->SRCadd] == INF){
+					reprobe(p->SRCadd);             // In range, so it is worth a probe that DLL resends
+					arm_probe_timer();
 				}
+				uint8_t changed = merge_vector(p->SRCadd, p->TRANseg);
+				if((distanceTable[ID][p->SRCadd] == INF) && (p->TRANseg[ID] != INF)){
+					distanceTable[ID][p->SRCadd] = p->TRANseg[ID];
+					changed = 1;
+				}
+				if(changed)
+					update_routes();
 			}
+			p->control[0] = 4;                 // Set control to parity check, echo acknowledgment and distance table
+			p->DESTadd = p->SRCadd;             // Set destination to source of received packet
+			p->SRCadd = ID;                 // Source is now ID of this ill matto
+			pbuf_trim(pb, p->length - ECHO_SIZE);
+			p->length = ECHO_SIZE;             // Header and distance vector
+
+			// Only the distance vector of this Ill Matto, not the whole table
+			for(uint8_t i = 0; i < ID_RANGE; i++)
+				p->TRANseg[i] = routeDist[i];
 			
-			p.checksum = parCheck(&p);        // Calculate parity check
+			net_seal(p);                           // Calculate parity check
 			
-			// Convert packet struct to array and send DLL
-			passPacket(&p, p.DESTadd);
+			// Packet already formatted in place, send to DLL
+			passPacket(pb, p->DESTadd);
 		}
 
 		// Received echo acknowledgment and their distance table in TRAN segment
-		if(p.control[0] == 4){    
-			if(p.DESTadd == ID){
-				put_str("\n\rReceived ECHO ACK\n\r");
-				echo(&p, p.SRCadd);       // Stop echo timer, calculate distance
-				int k = 0;
-				for(int j = 0; j < ID_RANGE; j++){
-					for(int i = 0; i < ID_RANGE; i++){
-						
-						// Take average between recieved distance table and current table
-						if((p.TRANseg[k] != INF)&&(distanceTable[i][j] != INF))						
-							distanceTable[i][j] = (p.TRANseg[k] + distanceTable[i][j])/2;
-						else{
-							if(p.TRANseg[k] == INF)
-								distanceTable[i][j] = distanceTable[i][j];	
-							else
-								distanceTable[i][j] = p.TRANseg[k];										
-						}							
-						k++;
-					}
-				}
+		if((p->control[0] == 4) && (p->length >= ECHO_SIZE)){
+			if((p->DESTadd == ID) && (p->SRCadd < ID_RANGE)){   // Source checked before it indexes the table
+				LOG_INFO("Received ECHO ACK\n\r");
+				uint8_t link = distanceTable[ID][p->SRCadd];
+				echo(pb, p->SRCadd);       // Stop echo timer, calculate distance
+				uint8_t changed = (distanceTable[ID][p->SRCadd] != link);
+
+				changed |= merge_vector(p->SRCadd, p->TRANseg);
+				if(changed)
+					update_routes();           // Only now, not for every packet forwarded
 			}                    
 		}
 	}
 
 	else{
-		put_str("Parity Check: FAIL\n\r");
+		LOG_ERROR("Parity Check: FAIL\n\r");
+		STATS_INC(net_errors);
 		return;
 	}
 
@@ -177,279 +357,292 @@ void receive_NET(uint8_t DLLpacket[]){
 
 
 // EVEN MULTI-BIT PARITY CHECK
-// Split packet into 15 chunks of 8 bytes and 1 chunk of 6 bytes
-// Each chunk calculated even parity
-int parCheck(Packet* p){
-    int evenPar[16];
-    int n = p->checksum;
-    int setBits = 0;
-    int tranBit = 3;
-    int limit = 11;
-
-    // Count number of logic high bits in parity chunk (8 bytes)
-    setBits = countSetBits(p->control[0]) + countSetBits(p->control[1]);
-    setBits += countSetBits(p->SRCadd);
-    setBits += countSetBits(p->DESTadd);
-    setBits += countSetBits(p->length);
-    setBits += countSetBits(p->TRANseg[0]) + countSetBits(p->TRANseg[1]) + countSetBits(p->TRANseg[2]);
-
-    // Determine even parity
-    if(setBits%2==0)
-        evenPar[0] = 0;
-    else
-        evenPar[0] = 1;
-    setBits = 0;
-
-    for(int parBit = 1; parBit < 16; parBit++){
-        
-        for(tranBit; tranBit < limit; tranBit++)
-            setBits =+ p->TRANseg[tranBit];
-        
-        if(setBits%2==0)
-            evenPar[parBit] = 0;
-        else
-            evenPar[parBit] = 1;    
-        setBits = 0; 
-        tranBit =+ 8;
-        limit =+ 8;
-    }     
-    return binToDec(evenPar);
+// Split packet into chunks of 8 bytes up to the checksum, 16 of them for a full size packet
+// Each chunk calculated even parity, bit n of the result holds the parity of chunk n
+// The parity of a chunk is the parity of the xor of its bytes, so no bits are counted
+uint16_t parCheck(Packet* p){
+    uint8_t* bytes = (uint8_t*) p;
+    uint16_t par = 0;
+    uint8_t end = p->length - NET_TRAILER_SIZE;
+
+    for(uint8_t parBit = 0; (parBit < 16) && (parBit * 8 < end); parBit++){
+        uint8_t x = 0;
+        uint8_t limit = (parBit + 1) * 8;
+        if(limit > end)
+            limit = end;
+
+        for(uint8_t i = parBit * 8; i < limit; i++)
+            x ^= bytes[i];
+        x ^= x >> 4;
+        x ^= x >> 2;
+        x ^= x >> 1;
+        par |= (uint16_t)(x & 1) << parBit;
+    }
+    return par;
 }
 
-uint8_t countSetBits(uint8_t n) 
-{ 
-    uint8_t result = 0; 
-    while (n) { 
-        result += n & 1; 
-        n >>= 1; 
-    } 
-    return result; 
-} 
-
-int binToDec(int binary[]){
-    int dec = 0;
-    for(int i = 0; i < 16; i++)
-        if(binary[i] == 1)
-            dec += pow(2,i);
-
-    return dec;
+// FLOODING
+// 1 if the packet came by before, it is recorded otherwise
+uint8_t flood_seen(Packet* p){
+	for(uint8_t i = 0; i < FLOOD_CACHE_SIZE; i++){
+		if((floodSeen[i].SRCadd == p->SRCadd) && (floodSeen[i].seq == p->seq))
+			return 1;
+	}
+	floodSeen[floodNext].SRCadd = p->SRCadd;
+	floodSeen[floodNext].seq = p->seq;
+	floodNext = (floodNext + 1) % FLOOD_CACHE_SIZE;
+	return 0;
 }
 
-
-
-// FLOODING
-void flooding(Packet* p){
-	put_str("FLOODING\n\r");  
+void flooding(pbuf* pb){
+	Packet* p = (Packet*) pbuf_data(pb);
+	LOG_DEBUG("FLOODING\n\r");  
 	
     if(p->DESTadd == ID){
-        put_str("Destination: FOUND\n\r");
-        passPacket(p,INF);
+        LOG_DEBUG("Destination: FOUND\n\r");
+        passPacket(pb,INF);
     }
     else{
-		put_str("Destination: NOT FOUND\n\r");
-		put_str("FORWARD packet:\n\n\r");
-        if(p->SRCadd != ID)
+        if(IN_GROUP(p->DESTadd, ID) && (p->SRCadd != ID)){
+            LOG_DEBUG("Group member: FOUND\n\r");
+            passPacket(pb,INF);                 // Flooded on to the other members as well
+        }
+		LOG_DEBUG("Destination: NOT FOUND\n\r");
+		LOG_DEBUG("FORWARD packet:\n\r");
+        if(p->SRCadd != ID){
+            if(p->control[1] == 0){
+                LOG_DEBUG("Hop limit: DROP\n\r");
+                return;
+            }
             p->control[1]--;                    // Decrement Hop Count if Packet is not sent from this Ill Matto
-
-		flCount = 0;
-		flLimit = 0;
+        }
+
+		// DESTadd stays the final destination, only the DLL address differs,
+		// so every neighbour is sent the same buffer
+		net_seal(p);
+
+		// Best effort: the group holds nodes out of range as well, DLL would resend to them one
+		// by one. Every node floods the packet on, so that is where the redundancy comes from.
+#if ID_RANGE <= GROUP_MAX
+		// One group transmission reaches every neighbour
+		uint8_t floodGroup = ((1 << ID_RANGE) - 1) & ~(1 << ID);
+		if(p->SRCadd < ID_RANGE)
+			floodGroup &= ~(1 << p->SRCadd);
+		if(floodGroup)
+			transmit_DLL(pb, GROUP_OF(floodGroup), FLOOD_HOP_TIMEOUT);
+#else
         for(uint8_t floodID = 0; floodID < ID_RANGE; floodID++){      // Sent Packet to Every Node
-            if((floodID != ID) && (floodID != p->SRCadd)){
-				if(flLimit == 1){
-					flLimit = 0;					
-					floodID++;
-				}
-				else{
-					p->DESTadd = floodID;
-					p->checksum = parCheck(p);
-					passPacket(p,floodID);				
-				}
-            }
+            if((floodID != ID) && (floodID != p->SRCadd))
+				transmit_DLL(pb, floodID, FLOOD_HOP_TIMEOUT);
         }       
+#endif
     }    
 }
 
 
 // DISTANCE VECTOR ROUTING
-void distVec(Packet* p){
-    put_str("DISTANCE VECTOR ROUTING\n\r");
-	
-	char str[30]; 
-    uint8_t distance[5];      // Store first row of matrix, updates itself according to new nodes it visits so that particular element will have the least distance
-    uint8_t visitedNode[5];   // Give info about nodes visited during algorithm running
-    uint8_t prevDists[5];     // Info on previous distances
-    uint8_t minDist;          // Store min distance
-    uint8_t nextNode = 0;
-
-    uint8_t nextHop;
-    uint8_t destination;
-    uint8_t numHops;
-
-	if(p->DESTadd == ID){
-        put_str("Destination: FOUND\n\r");
-        passPacket(p,INF);
-    }
-	
-	else{
-		for(uint8_t i = 0; i < ID_RANGE; i++){
-			visitedNode[i] = 0;
-			prevDists[i] = 0;
-			distance[i] = distanceTable[i][0];
+// Shortest paths from this Ill Matto over distanceTable (Dijkstra), remembering the
+// first hop of each path instead of walking the predecessors for every packet
+static void update_routes(void){
+	uint16_t distance[ID_RANGE];	// Sums of uint8_t distances, so INF is not a limit
+	uint8_t visitedNode[ID_RANGE];
+
+	for(uint8_t i = 0; i < ID_RANGE; i++){
+		distance[i] = 0xFFFF;
+		visitedNode[i] = 0;
+		nextHop[i] = INF;
+	}
+	distance[ID] = 0;
+
+	for(uint8_t n = 0; n < ID_RANGE; n++){
+		uint8_t nextNode = INF;
+		uint16_t minDist = 0xFFFF;
+		for(uint8_t j = 0; j < ID_RANGE; j++){
+			if((visitedNode[j] != 1) && (distance[j] < minDist)){
+				minDist = distance[j];
+				nextNode = j;
+			}
 		}
-		distance[ID] = 0;
-		visitedNode[ID] = 1;
-
-		for(uint8_t i = 0; i < ID_RANGE; i++){
-			minDist = INF;
-			for(uint8_t j = 0; j < ID_RANGE; j++){
-				if((minDist > distance[j]) && (visitedNode[j] != 1)){
-					minDist = distance[j];
-					nextNode = j;
-				}
+		if(nextNode == INF)
+			break;                          // Rest of the nodes is unreachable
+		visitedNode[nextNode] = 1;
+
+		for(uint8_t j = 0; j < ID_RANGE; j++){
+			if((visitedNode[j] != 1) && (distanceTable[nextNode][j] != INF)
+					&& (minDist + distanceTable[nextNode][j] < distance[j])){
+				distance[j] = minDist + distanceTable[nextNode][j];
+				nextHop[j] = (nextNode == ID) ? j : nextHop[nextNode];
 			}
+		}
+	}
+	uint8_t reach = 0;
+	for(uint8_t i = 0; i < ID_RANGE; i++){
+		uint8_t dist = (distance[i] < INF) ? distance[i] : INF;
+		if((dist == INF) != (routeDist[i] == INF))
+			reach = 1;
+		routeDist[i] = dist;
+	}
+	// A node came into reach or went out of it, the neighbours are sent the vector soon
+	// instead of at their next probe, so routes over several hops form in a few round trips
+	if(reach){
+		for(uint8_t i = 0; i < ID_RANGE; i++){
+			if((i != ID) && (distanceTable[ID][i] != INF))
+				neighbours[i].nextProbe = netTicks;
+		}
+		arm_probe_timer();
+	}
+}
 
-			visitedNode[nextNode] = 1;
+// Group packet: the members that are neighbours are sent it in one group transmission,
+// every other member a copy of its own over its next hop, so it is never forwarded again
+static void distVec_group(pbuf* pb){
+	Packet* p = (Packet*) pbuf_data(pb);
+	uint8_t members = GROUP_MEMBERS(p->DESTadd);
 
-			// Start of ALGORITHM
-			for(uint8_t j = 0; j < ID_RANGE; j++){
-				if(visitedNode[j] != 1){
-					if(minDist+distanceTable[nextNode][j] < distance[j]){
-						distance[j] = minDist+distanceTable[nextNode][j];
-						prevDists[j] = nextNode;
-					}
-				}
-			}
+	if(p->SRCadd != ID){
+		if(members & (1 << ID)){
+			LOG_DEBUG("Group member: FOUND\n\r");
+			passPacket(pb,INF);
 		}
-		destination = p->DESTadd;
-		nextHop = destination;
-		numHops = 0;
-		while(nextHop != 0){
-			nextHop = prevDists[nextHop];
-			numHops++;
+		return;
+	}
+	uint8_t direct = 0;
+	for(uint8_t i = 0; i < ID_RANGE; i++){
+		if(!(members & (1 << i)) || (i == ID) || (nextHop[i] == INF))
+			continue;
+		if(nextHop[i] == i){
+			direct |= 1 << i;
+			continue;
 		}
-		put_str("Number of Hops: ");
-		sprintf(str, "%d", numHops);
-		put_str(str);
-		put_str("\n\r");
-		if(numHops == 1)
-			passPacket(p, destination); //printf("Next Hop ID: %i\n",destination);
-			
-		else
-			passPacket(p, prevDists[destination]); //printf("Next Hop ID: %i\n",prevDists[destination]);
+		pbuf* cp = pbuf_copy(pb);
+		if(!cp)
+			continue;
+		Packet* q = (Packet*) pbuf_data(cp);
+		q->DESTadd = i;
+		net_seal(q);
+		passPacket(cp, nextHop[i]);
+		pbuf_free(cp);
+	}
+	if(direct){
+		p->DESTadd = GROUP_OF(direct);
+		net_seal(p);
+		passPacket(pb, p->DESTadd);
 	}
 }
 
+// Only distance vector routing knows the neighbours, a flooded group may pass forwarders
+uint8_t net_group_direct(uint8_t group){
+	if((ROUTING != DISTVEC) || !IS_GROUP(group))
+		return 0;
+	for(uint8_t i = 0; i < ID_RANGE; i++){
+		if((GROUP_MEMBERS(group) & (1 << i)) && (i != ID) && (nextHop[i] != i))
+			return 0;
+	}
+	return 1;
+}
+
+void distVec(pbuf* pb){
+	Packet* p = (Packet*) pbuf_data(pb);
+	LOG_DEBUG("DISTANCE VECTOR ROUTING\n\r");
+
+	if(IS_GROUP(p->DESTadd))
+		distVec_group(pb);
+	else if(p->DESTadd == ID){
+		LOG_DEBUG("Destination: FOUND\n\r");
+		passPacket(pb,INF);
+	}
+	else if((p->DESTadd < ID_RANGE) && (nextHop[p->DESTadd] != INF)){
+		LOG_DEBUG_VAL("Next Hop ID: ", nextHop[p->DESTadd]);
+		passPacket(pb, nextHop[p->DESTadd]);
+	}
+	else
+		LOG_DEBUG("Destination: UNREACHABLE\n\r");
+}
+
 
 // ECHO
-void echo(Packet* p, uint8_t ecID){    
-	char str[10];   
+// Probe of the link to ecID, only the header and the distance vector of this Ill Matto
+static void send_echo(uint8_t ecID){
+	neighbours[ecID].echoSent = netTicks;
+	echoWaiting[ecID / 8] |= (1 << (ecID % 8));
+	arm_echo_timer();
+
+	pbuf* cp = pbuf_alloc(0);
+	if(!cp)
+		return;
+	Packet* q = (Packet*) pbuf_put(cp, ECHO_SIZE);
+	q->control[0] = 2;                      // Echo, the distance vector in place of the TRAN segment
+	q->control[1] = 0;
+	q->SRCadd = ID;
+	q->DESTadd = ecID;
+	q->length = ECHO_SIZE;
+	q->seq = 0;
+	for(uint8_t i = 0; i < ID_RANGE; i++)
+		q->TRANseg[i] = routeDist[i];       // Distance vector of this Ill Matto
+	net_seal(q);
+	// A node not known as neighbour may be out of range, its probe is sent once and not
+	// resent, so it does not hold up the DLL queue
+	transmit_DLL(cp, ecID, (distanceTable[ID][ecID] != INF) ? ECHO_HOP_TIMEOUT : ECHO_FIND_TIMEOUT);
+	pbuf_free(cp);
+}
 
-    // Send ECHO
-    if((p->control[0] == 2) || (p->control[0] == 3)){
-		if(ecID == 0){
-			ecCount0 = 0;
-		}
-		if(ecID == 1){
-			ecCount1 = 0;
-		}
-		if(ecID == 2){
-			ecCount2 = 0;
+// Sends the first probe due, one per ECHO_SPACING, whether this Ill Matto sends packets of its own or not
+static void probe_timeout(timer* t){
+	expire_echoes();
+	for(uint8_t i = 0; i < ID_RANGE; i++){
+		if((i != ID) && !(echoWaiting[i / 8] & (1 << (i % 8)))
+				&& ((int16_t)(netTicks - neighbours[i].nextProbe) >= 0)){
+			LOG_INFO("Send ECHO\n\r");
+			send_echo(i);
+			break;
 		}
-        p->DESTadd = ecID;
-		p->checksum = parCheck(p);
-		passPacket(p, ecID);
-    }
+	}
+	arm_probe_timer();
+}
+
+// Echo ACK from ecID, the link cost follows its round trip
+void echo(pbuf* pb, uint8_t ecID){    
+	Packet* p = (Packet*) pbuf_data(pb);
+	if(ecID >= ID_RANGE)
+		return;
 
     // Recieve ECHO Acknowledgement
     if((p->control[0] == 4) || (p->control[0] == 5)){			
-		put_str("\nID: ");
-		sprintf(str, "%d", ecID);
-		put_str(str);
-		put_str("\n\n\n\n\n\n\n\n\n\n\n\n\n\r");			
-		
-		if(ecID == 0){
-			if(ecLimit0 == 1){
-				ecLimit0 = 0;
-				put_str("Time taken: ");
-				sprintf(str, "%d", INF);
-				put_str(str);
-				put_str("\n\r");
-				distanceTable[ID][ecID] = INF;	
-				distanceTable[ecID][ID] = INF;	
-			}
-			else{
-				put_str("Time taken: ");
-				sprintf(str, "%d", ecCount0);
-				put_str(str);
-				put_str("\n\r");
-				distanceTable[ID][ecID] = ecCount0;	
-				distanceTable[ecID][ID] = ecCount0;	
-			}				
-		}
-		if(ecID == 1){
-			if(ecLimit1 == 1){
-				ecLimit1 = 0;
-				put_str("Time taken: ");
-				sprintf(str, "%d", INF);
-				put_str(str);
-				put_str("\n\r");
-				distanceTable[ID][ecID] = INF;	
-				distanceTable[ecID][ID] = INF;	
-			}
-			else{
-				put_str("Time taken: ");
-				sprintf(str, "%d", ecCount1);
-				put_str(str);
-				put_str("\n\r");
-				distanceTable[ID][ecID] = ecCount1;	
-				distanceTable[ecID][ID] = ecCount1;	
-			}
-		}
-		if(ecID == 2){
-			if(ecLimit2 == 1){
-				ecLimit2 = 0;
-				put_str("Time taken: ");
-				sprintf(str, "%d", INF);
-				put_str(str);
-				put_str("\n\r");
-				distanceTable[ID][ecID] = INF;	
-				distanceTable[ecID][ID] = INF;	
-			}
-			else{
-				put_str("Time taken: ");
-				sprintf(str, "%d", ecCount2);
-				put_str(str);
-				put_str("\n\r");
-				distanceTable[ID][ecID] = ecCount2;	
-				distanceTable[ecID][ID] = ecCount2;	
-			}
-
-		}
-               
+		LOG_DEBUG_VAL("ID: ", ecID);
+		if(!(echoWaiting[ecID / 8] & (1 << (ecID % 8))))
+			return;                             // Answered already
+		echoWaiting[ecID / 8] &= ~(1 << (ecID % 8));
+		arm_echo_timer();
+
+		neighbours[ecID].misses = 0;
+		uint16_t sample = netTicks - neighbours[ecID].echoSent;
+		if(sample >= ECHO_TIMEOUT)
+			sample = ECHO_TIMEOUT;
+		if(neighbours[ecID].rtt == 0)
+			neighbours[ecID].rtt = sample * 8;        // First sample
+		else
+			neighbours[ecID].rtt = neighbours[ecID].rtt - neighbours[ecID].rtt / 4 + sample * 2;  // 1/4 weight
+
+		uint16_t cost = neighbours[ecID].rtt / 8;
+		uint8_t dist = (cost == 0) ? 1 : ((cost < INF) ? cost : INF - 1);  // INF stays unreachable
+		uint8_t old = distanceTable[ID][ecID];
+		schedule_probe(ecID, (old != INF) && (dist <= old + old / 4 + 1) && (dist + dist / 4 + 1 >= old));
+		LOG_DEBUG_VAL("Time taken: ", dist);
+		distanceTable[ID][ecID] = dist;
+		arm_probe_timer();
     }
 }
 
 
-void passPacket(Packet* p, uint8_t hopID){
-    uint8_t NETpacket[NET_SIZE];
-   	char str[40]; 
-	
-    // Convert packet struct to array
-    NETpacket[0] = p->control[0];
-    NETpacket[1] = p->control[1];
-    NETpacket[2] = p->SRCadd;
-    NETpacket[3] = p->DESTadd;
-    NETpacket[4] = p->length;
-    for(int i = 5; i < TRAN_SIZE + 5; i++)
-        NETpacket[i] = p->TRANseg[i];
-    NETpacket[126] = p->checksum & 0xff;
-    NETpacket[127] = p->checksum >> 8;
-
-    // Send to TRAN or DLL
-    if(hopID > ID_RANGE-1){
-		transport_layer_receive(p->TRANseg, p->SRCadd);		
+void passPacket(pbuf* pb, uint8_t hopID){
+    Packet* p = (Packet*) pbuf_data(pb);
+
+    // Send to TRAN or DLL, packet already formatted in buffer
+    if((hopID > ID_RANGE-1) && !IS_GROUP(hopID)){
+		transport_layer_receive(p->TRANseg, p->length - NET_MIN_SIZE, p->SRCadd);		
     }
     else{
-		transmit_DLL(NETpacket, hopID);
+		// Each packet is given up on its own once the next hop does not ACK it for long enough
+		transmit_DLL(pb, hopID, p->control[0] ? ECHO_HOP_TIMEOUT : HOP_TIMEOUT);
     }
-}
\ No newline at end of file
+}
@@ -3,73 +3,111 @@
 
 #include <stdio.h>
 #include <inttypes.h>
-#include <math.h>
-#include "../LLC/LLC.h"
+#include "../common/pbuf.h"
+#include "../common/integrity.h"
+#include "../common/group.h"
+#include "../2_2_LLC/LLC.h"
+#include "../4_TRAN/TRAN.h"
 
 #include <avr/interrupt.h>
 #include <avr/io.h>
 #include <stdlib.h>
 #include <util/delay.h>
 #include <string.h>
-#include "../rfm12.h"
+#include <util/atomic.h>
+#include "../rfm12lib/rfm12.h"
 
 
 // CONSTANT DEFINITIONS
-#define TRAN_SIZE 121 // Size of Transport Segment
+#define TRAN_SIZE 120 // Size of Transport Segment
 #define NET_SIZE 128  // Size of Network Packet
+#define NET_HEADER_SIZE 6   // control[2], SRCadd, DESTadd, length, seq in front of TRAN segment
+#define NET_TRAILER_SIZE 2  // checksum behind TRAN segment
+#define NET_MIN_SIZE (NET_HEADER_SIZE + NET_TRAILER_SIZE)   // Packet without TRAN segment
+#define ECHO_SIZE (NET_MIN_SIZE + ID_RANGE)                 // Echo and echo ACK, a distance vector in place of the TRAN segment
 #define INF 255       // Infinity
 #define FLOODING 0    // Flooding Routing = 0
 #define DISTVEC 1     // Distance Vector Routing = 1
-
-// VARIABLES
+#define ECHO_TIMEOUT 1000   // NET ticks (~10s) before a neighbour counts as unreachable
+#define ECHO_FIND_WAIT 100  // NET ticks (~1s) an echo to a node not known as neighbour waits for its ACK
+#define ECHO_MIN_INTERVAL 300   // NET ticks (~3s) between probes of a link that changed
+#define ECHO_MAX_INTERVAL 6000  // NET ticks (~60s) between probes of a stable link
+#define ECHO_RESEND_SPIKE 14    // DLL resends during one packet above twice the usual that make every link probed again
+#define ECHO_MISSES 2           // Echoes in a row without ACK before the link counts as gone
+#define ECHO_JITTER 50          // NET ticks (~0.5s) at most added to a probe time, neighbours started together probe apart
+#define ECHO_SPACING 5          // NET ticks (~50ms) at least between two probes, DLL queues them in turn
+#define HOP_TIMEOUT (500 * NET_TICK_DIV)    // MAC ticks (~5s) DLL goes on resending a packet to the next hop, from its first frame
+#define ECHO_HOP_TIMEOUT (200 * NET_TICK_DIV) // The same for echoes and echo ACKs, one given up counts as a miss
+#define ECHO_FIND_TIMEOUT 1     // MAC ticks for an echo to a node not known as neighbour, given up at its first ACK timeout
+#define FLOOD_HOP_TIMEOUT 1     // MAC ticks for a flooded packet, sent once and given up at its first ACK timeout
+#define FLOOD_CACHE_SIZE 8  // (SRCadd, seq) of the last flooded packets, repeats are dropped
+
+// VARIABLES, can be overridden per build (e.g. DEFS += -DID=2)
+#ifndef ID
 #define ID 0        // This Ill Matto ID
-#define ID_RANGE 2    // Number of Ill Mattos in Network
+#endif
+#ifndef ID_RANGE
+#define ID_RANGE 2    // Number of Ill Mattos in Network, the only place it is set
+#endif
+#ifndef ROUTING
 #define ROUTING 1     // Routing Mode: 0 = Flooding, 1 = Distance Vector 
+#endif
+
+
+// The echo ACK carries the distance vector of its sender in the TRAN segment
+#if (ROUTING == DISTVEC) && (ID_RANGE > TRAN_SIZE)
+#error "distance vector does not fit into an echo ACK"
+#endif
 
 
 // Packet Structure
+// Overlaid onto the packet buffer, so header and checksum are written in place around the TRAN segment.
+// Only length bytes are sent: the TRAN segment is as long as TRAN made it and the checksum,
+// MSB first, follows right behind it (net_trailer()).
 typedef struct Packets{
     uint8_t control[2];         // control[1] = Hop Count, control[0] = check type and routing control
     uint8_t SRCadd;             // Source Address
     uint8_t DESTadd;            // Destination Address
-    uint8_t length;             // Length of Packet
-    uint8_t TRANseg[TRAN_SIZE]; // 121-bit Transport Segment
-    uint16_t checksum;          // Checksum
+    uint8_t length;             // Length of Packet, header, TRAN segment and checksum
+    uint8_t seq;                // Sequence Number, per Source Address
+    uint8_t TRANseg[TRAN_SIZE]; // Transport Segment, up to 120 bytes
 }Packet;
 
+// Checksum bytes of the packet
+static inline uint8_t* net_trailer(Packet* p){
+    return (uint8_t*) p + p->length - NET_TRAILER_SIZE;
+}
+
 
 // Network Layer Transmit and Receive
-void transmit_NET(uint8_t TRANseg[], uint8_t DESTaddr);
-void receive_NET(uint8_t DLLpacket[]);
+void transmit_NET(pbuf* pb, uint8_t DESTaddr);  // pb holds TRAN segment, NET_HEADER_SIZE headroom needed, DESTaddr may be a group
+void receive_NET(pbuf* pb);
+void init_NET(void);
 
 // Routing
-void flooding(Packet* p);
-void distVec(Packet* p);
+void flooding(pbuf* pb);
+uint8_t flood_seen(Packet* p);
+void distVec(pbuf* pb);
 
-void echo(Packet* p, uint8_t ecID);
+uint8_t net_group_direct(uint8_t group); // 1 if every member is a neighbour, so one group transmission reaches them all
+void echo(pbuf* pb, uint8_t ecID);     // Echo ACK from ecID received, probes are sent on a timer
 //void initialDists();
 
-// Even Multiple-Bit Parity Check
-int parCheck(Packet* p);                   
-uint8_t countSetBits(uint8_t n); // Count number of bits high in binary conversion of integer
-int binToDec(int binary[]);                // Convert binary to decimal
+// Even Multiple-Bit Parity Check, only used with INTEGRITY_EVERY_LAYER (common/integrity.h)
+uint16_t parCheck(Packet* p);
+
 
+void tick_NET(void);              // Clock tick, ~10ms
 
-// Format packet and send to DLL or TRAN layers
-void passPacket(Packet* p, uint8_t hopID);
+// Send packet to DLL or TRAN layers
+void passPacket(pbuf* pb, uint8_t hopID);
 
 void setup();
 
-extern volatile uint16_t flCount;
-extern volatile uint8_t flLimit;
 extern uint8_t DLL_ACK;
-extern volatile uint16_t ecCount0;
-extern volatile uint16_t ecCount1;
-extern volatile uint16_t ecCount2;
-extern volatile uint8_t ecLimit0;
-extern volatile uint8_t ecLimit1;
-extern volatile uint8_t ecLimit2;
+extern volatile uint16_t netTicks;   // NET timer ticks (~10ms) since start
 
+// Row ID holds the link costs of this Ill Matto, row k the distance vector last received from k
 extern volatile uint8_t distanceTable[ID_RANGE][ID_RANGE];  // Routing Table Store Distance to each Element
 
 #endif
\ No newline at end of file
@@ -4,85 +4,70 @@
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
 #include <util/delay.h>
+#include <util/atomic.h>
 #include "TRAN.h"
+#include "../3_NET/NET.h"
 #include "../rfm12lib/uart.h"
 
 
 //#define CRYSTAL_FREQUENCY 12000000 //12 MHz
-uint16_t expand_timer_counter;
-struct Status status;
+static struct Connection connections[ID_RANGE]; //Indexed by peer ID
+static void tran_timeout(timer* t);
 //TIMER
-void start_timer(uint8_t compare_value){
-  cli();
-  TCNT0 = 0x00; //Reset status.timer_counter register
-  OCR0A = compare_value; // compare_value/(12000000/1024)
-  //Start timer by setting Set 1024 prescaler
-  TCCR0B |= (1<<CS02) | (1<<CS00);
-  TCCR0B &= ~(1 << CS01);
-  sei();
-  expand_timer_counter = 300;
+static uint16_t timeout_of(uint8_t peer){
+  return connections[peer].state == DGRAM_PENDING ? DGRAM_TIMEOUT : TRAN_TIMEOUT;
 }
 
-void stop_timer(void){
-  cli();
-  TCCR0B &= ~(1<<CS02);
-  TCCR0B &= ~(1<<CS01);
-  TCCR0B &= ~(1<<CS00);
-  sei();
-  status.timer_counter = 0;
-  expand_timer_counter = 0;
+void start_timer(uint8_t peer){
+  timer_start(&connections[peer].retransmit, timeout_of(peer));
 }
 
-
-void init_timer(void){
-  TCCR0B &= ~(1<<CS02);
-  TCCR0B &= ~(1<<CS01);
-  TCCR0B &= ~(1<<CS00);
-
-  //Set CTC mode, Timer resets automatcally
-  TCCR0A |= (1<<WGM01);
-  TCCR0A &= ~(1<<WGM00);
-  TCCR0B &= ~(1<<WGM02);
-
-  // Normal port operation, OC0A disconnected.
-  TCCR0A &= (0<<COM0A1);
-  TCCR0A &= (0<<COM0A0);
-
-  //Enable Compare Match
-  TIMSK0 |= (1<<OCIE0A);
-
+void stop_timer(uint8_t peer){
+  struct Connection* c = &connections[peer];
+  //Answered before the timer ran out and sent only once, so it is the round trip of this segment
+  if(timer_active(&c->retransmit) && !c->timer_counter)
+    STATS_TIME(segment_rtt, timeout_of(peer) - timer_left(&c->retransmit));
+  timer_stop(&c->retransmit);
+  connections[peer].timer_counter = 0;
 }
 
 void init_transport_layer(void){
-  status.timer_counter = 0;
-  status.NACK_counter = 0;
-  status.state = IDLE;
-  status.connect_id = -1;
-  status.number_of_data_packages = 0;
-  init_timer();
-
+  for(uint8_t i = 0; i < ID_RANGE; i++){
+    connections[i].timer_counter = 0;
+    connections[i].NACK_counter = 0;
+    connections[i].state = IDLE;
+    timer_setup(&connections[i].retransmit, tran_timeout, i);
+    connections[i].transmitt_head = 0;
+    connections[i].number_of_data_packages = 0;
+    connections[i].tx_seq = 0;
+    connections[i].rx_seq_valid = 0;
+    connections[i].receive_length = 0;
+  }
+  sram_budget(SRAM_TRAN, sizeof(connections));
 }
 
-void reset_layer(void){
-  status.timer_counter = 0;
-  status.NACK_counter = 0;
-  status.state = IDLE;
-  status.connect_id = -1;
-  status.number_of_data_packages = 0;
-}
 
 
+//Sums are reduced once per block instead of twice per byte; 21 bytes is the
+//longest block for which sum2 can not overflow 16 bits
+#define FLETCHER16_BLOCK 21
 
 uint16_t Fletcher16( uint8_t *data, int count )
 {
    uint16_t sum1 = 0;
    uint16_t sum2 = 0;
-   int index;
 
-   for ( index = 0; index < count; ++index )
+   while (count > 0)
    {
-      sum1 = (sum1 + data[index]) % 255;
-      sum2 = (sum2 + sum1) % 255;
+      uint8_t block = count > FLETCHER16_BLOCK ? FLETCHER16_BLOCK : count;
+      count -= block;
+      do
+      {
+         sum1 += *data++;
+         sum2 += sum1;
+      } while (--block);
+      sum1 %= 255;
+      sum2 %= 255;
    }
 
    return (sum2 << 8) | sum1;
@@ -90,10 +75,17 @@ uint16_t Fletcher16( uint8_t *data, int count )
 
 
 
+//End to end check, left out (zero) when the integrity policy trusts the LLC CRC
+//Covers segment[LENGTH] bytes, the last two are the checksum
 void add_checksum(uint8_t segment[]){
-  uint16_t checksum = Fletcher16(segment, APPDATA_SIZE+ HEADER_SIZE-2); //TA_SIZE+ HEADER_SIZE-2 all elements except checksum
-  segment[CHECKSUM] = (uint8_t) (checksum>>8); //sum_2
-  segment[CHECKSUM + 1] = (uint8_t) checksum; //sum_1
+  uint8_t at = segment[LENGTH] - 2; //All elements except checksum
+#if TRAN_CHECK
+  uint16_t checksum = Fletcher16(segment, at);
+#else
+  uint16_t checksum = 0;
+#endif
+  segment[at] = (uint8_t) (checksum>>8); //sum_2
+  segment[at + 1] = (uint8_t) checksum; //sum_1
 }
 
 void connect_to_node(uint8_t connect_segment[]){
@@ -102,296 +94,352 @@ void connect_to_node(uint8_t connect_segment[]){
   connect_segment[CONTROL + 1] = 0;
   connect_segment[SRC_PORT] = 0;
   connect_segment[DEST_PORT] = 0;
-  connect_segment[LENGTH] = APPDATA_SIZE + HEADER_SIZE;
-  for (int i = APP_DATA; i< APPDATA_SIZE + APP_DATA; i++){
-    connect_segment[i] = 0;
-  }
+  connect_segment[LENGTH] = SEGMENT_SIZE(0); //No app data
   add_checksum(connect_segment);
 
 }
 
-void end_con(void){
-  status.timer_counter = 0;
-  status.NACK_counter = 0;
-  status.state = IDLE;
-  status.connect_id = -1;
-  if(!status.number_of_data_packages) return;
-  else if(status.number_of_data_packages == 1){
-    status.number_of_data_packages--;
-    return;
+//Segments are built straight into a pool buffer with headroom for the NET header
+void send_connect(uint8_t dest_ID){
+  pbuf* pb = pbuf_alloc(NET_HEADER_SIZE);
+  if(!pb) return; //No buffer free, timer resends
+  connect_to_node(pbuf_put(pb, SEGMENT_SIZE(0)));
+  transmit_NET(pb, dest_ID);
+  pbuf_free(pb);
+}
+
+void send_control_seq(uint8_t control, uint8_t seq, uint8_t dest_ID){
+  pbuf* pb = pbuf_alloc(NET_HEADER_SIZE);
+  if(!pb) return; //No buffer free, timer resends
+  uint8_t *segment = pbuf_put(pb, SEGMENT_SIZE(0));
+  create_dummy_segment(segment);
+  segment[CONTROL] = control;
+  segment[SEGMENT_SEQ] = seq;
+  add_checksum(segment);
+  transmit_NET(pb, dest_ID);
+  pbuf_free(pb);
+}
+
+void send_control(uint8_t type, uint8_t dest_ID){
+  send_control_seq(type<<4, 0, dest_ID);
+}
+
+//Data segment was built when it was queued, send it as is
+void send_data(uint8_t peer){
+  struct Connection* c = &connections[peer];
+  pbuf* pb = c->transmitt_buffer[c->transmitt_head];
+  if(pb->ref > 1) return; //Timer fired while it is still being sent
+  transmit_NET(pb, peer);
+}
+
+//Open a connection for the next queued segment, if the peer is free
+//A reliable datagram or a fast open is sent straight away and only waits for its ACK
+void start_next(uint8_t peer){
+  struct Connection* c = &connections[peer];
+  if(c->state != IDLE || !c->number_of_data_packages) return;
+  c->NACK_counter = 0;
+  uint8_t control = pbuf_data(c->transmitt_buffer[c->transmitt_head])[CONTROL];
+  if(control & DGRAM_ACK_REQ){
+    c->state = DGRAM_PENDING;
+    send_data(peer);
   }
-  else {
-    for(int i = APPDATA_SIZE+1; i < (status.number_of_data_packages*(APPDATA_SIZE+1)); i++){
-      status.transmitt_buffer[i-(APPDATA_SIZE+1)] = status.transmitt_buffer[i];
-    }
-    status.number_of_data_packages--;
-
-    //SEND DATA (As long as buffer isn't empty)
-    uint8_t segment[HEADER_SIZE+APPDATA_SIZE];
-    if(status.transmitt_buffer[0]<3){
-      //put_str("Buffer not empty");
-      status.state = AEP;
-      status.connect_id = status.transmitt_buffer[0];
-      connect_to_node(segment);
-      transmit_NET(segment, status.transmitt_buffer[0]);
-      start_timer(255); //10 is approx 1 ms!
-      return;
-    }
-    else{ //Error...
-      reset_layer();
-    }
+  else if(control & FAST_OPEN){ //CONNECTION_REQ with the data
+    c->state = AEP;
+    send_data(peer);
   }
+  else{
+    c->state = AEP;
+    send_connect(peer);
+  }
+  start_timer(peer);
 }
 
-void create_data_segment(uint8_t buffer[], uint8_t segment[]){
-  segment[CONTROL] = 0x00; //Message containing data, no crc
+void end_con(uint8_t peer){
+  struct Connection* c = &connections[peer];
+  //Only a connection this node opened owns the segment at the head of the queue
+  uint8_t sent = c->state == AEP || c->state == CLIENT_CONNECTED || c->state == ADP || c->state == DGRAM_PENDING;
+  stop_timer(peer);
+  c->NACK_counter = 0;
+  c->state = IDLE;
+  if(sent && c->number_of_data_packages){
+    pbuf_free(c->transmitt_buffer[c->transmitt_head]);
+    c->transmitt_head = (c->transmitt_head + 1) % TRANSMITT_QUEUE_SIZE;
+    c->number_of_data_packages--;
+  }
+
+  //SEND DATA (As long as buffer isn't empty)
+  start_next(peer);
+}
+
+//segment has room for SEGMENT_SIZE(length) bytes
+void create_data_segment(uint8_t app_data[], uint8_t length, uint8_t segment[], uint8_t control, uint8_t seq){
+  segment[CONTROL] = control; //Message containing data, no crc
   #if !USE_SEQUENCE_NUMBER
-  segment[CONTROL] = 0x00; //No sequence number, assuming app_data < 114
+  segment[CONTROL] |= 0x00; //No sequence number, assuming app_data < 113
   #else
   //ADD code for sequence_number here!
   #endif
+  segment[SEGMENT_SEQ] = seq;
   segment[SRC_PORT] = 0x00;
   segment[DEST_PORT] = 0x00;
-  segment[LENGTH] = APPDATA_SIZE + HEADER_SIZE;
-  for (int i = APP_DATA; i< APPDATA_SIZE + APP_DATA; i++){
-    segment[i] = buffer[i-APP_DATA+1]; //APP_DATA byte is the 5th, +1 to skip the ID...
+  segment[LENGTH] = SEGMENT_SIZE(length);
+  for (int i = APP_DATA; i< length + APP_DATA; i++){
+    segment[i] = app_data[i-APP_DATA]; //APP_DATA byte is the 5th
   }
   add_checksum(segment);
 }
 
+//Control segment without app data
 void create_dummy_segment(uint8_t segment[]){
-  for (int i = 0; i< APPDATA_SIZE + HEADER_SIZE;i++){
+  for (int i = 0; i< SEGMENT_SIZE(0);i++){
     segment[i] = 0x00;
   }
+  segment[LENGTH] = SEGMENT_SIZE(0);
 }
 int verify_checksum(uint8_t segment[]){
-  uint16_t checksum = Fletcher16(segment, APPDATA_SIZE+ HEADER_SIZE-2);
-  return segment[CHECKSUM] == (uint8_t) (checksum>>8) && segment[CHECKSUM + 1] == (uint8_t) checksum;
+#if TRAN_CHECK
+  uint8_t at = segment[LENGTH] - 2;
+  uint16_t checksum = Fletcher16(segment, at);
+  return segment[at] == (uint8_t) (checksum>>8) && segment[at + 1] == (uint8_t) checksum;
+#else
+  return 1; //Segment already passed the LLC CRC of every hop
+#endif
 }
 
-void transport_layer_receive(uint8_t segment[], uint8_t src_ID){
+void transport_layer_receive(uint8_t segment[], uint8_t length, uint8_t src_ID){
+  if (src_ID >= ID_RANGE || src_ID == ID) return;
+  if (length < SEGMENT_SIZE(0) || segment[LENGTH] < SEGMENT_SIZE(0) || segment[LENGTH] > length
+      || segment[LENGTH] > SEGMENT_SIZE(APPDATA_SIZE)){ //Cut short or too long
+    STATS_INC(tran_errors);
+    return;
+  }
+  struct Connection* c = &connections[src_ID];
+  uint8_t data_length = segment[LENGTH] - SEGMENT_SIZE(0);
 
   if (verify_checksum(segment)){
+    //Datagrams bypass the connection state machine
+    if(((segment[0]&0x70)>>4) == DATAGRAM){
+      if(segment[CONTROL] & DGRAM_ACK_REQ){
+        send_control_seq(DATAGRAM_ACK<<4, segment[SEGMENT_SEQ], src_ID);
+        if(c->rx_seq_valid && c->rx_seq == segment[SEGMENT_SEQ]) return; //Resent, the ACK was lost
+        c->rx_seq = segment[SEGMENT_SEQ];
+        c->rx_seq_valid = 1;
+      }
+      app_layer_receive(&segment[APP_DATA], data_length);
+      return;
+    }
+    //Fast open needs no server state either, the ACK closes the connection again
+    if(((segment[0]&0x70)>>4) == CONNECTION_REQ && (segment[CONTROL] & FAST_OPEN)){
+      send_control_seq((ACK<<4) | FAST_OPEN, segment[SEGMENT_SEQ], src_ID);
+      if(c->rx_seq_valid && c->rx_seq == segment[SEGMENT_SEQ]) return; //Resent, the ACK was lost
+      c->rx_seq = segment[SEGMENT_SEQ];
+      c->rx_seq_valid = 1;
+      app_layer_receive(&segment[APP_DATA], data_length);
+      return;
+    }
+    if(((segment[0]&0x70)>>4) == DATAGRAM_ACK){
+      if(c->state == DGRAM_PENDING && segment[SEGMENT_SEQ] == pbuf_data(c->transmitt_buffer[c->transmitt_head])[SEGMENT_SEQ])
+        end_con(src_ID);
+      return;
+    }
 
-    uint8_t answer_segment[APPDATA_SIZE + HEADER_SIZE];
-    switch(status.state){
+    switch(c->state){
       case IDLE: //Not connected; Only need to handle connection requests;
         if(((segment[0]&0x70)>>4) == CONNECTION_REQ){ //Connection request
-          status.connect_id = src_ID;
-          status.state = PEP;
-          create_dummy_segment(answer_segment);
-          answer_segment[CONTROL] = (ACK<<4);
-          add_checksum(answer_segment);
-          transmit_NET(answer_segment, src_ID);
-          start_timer(255);
+          c->state = PEP;
+          send_control(ACK, src_ID);
+          start_timer(src_ID);
         }
         break;
       case PEP:
         if(((segment[0]&0x70)>>4) == DATA_MESSAGE){
-          stop_timer();
-          status.state = SERVER_CONNECTED;
-          create_dummy_segment(answer_segment);
-          answer_segment[CONTROL] = (ACK<<4);
-          add_checksum(answer_segment);
-          for(int i = 0;i <APPDATA_SIZE;i ++){
-            status.receive_buffer[i] = segment[i+APP_DATA];
+          stop_timer(src_ID);
+          c->state = SERVER_CONNECTED;
+          for(int i = 0;i <data_length;i ++){
+            c->receive_buffer[i] = segment[i+APP_DATA];
           }
-          transmit_NET(answer_segment, src_ID);
-          start_timer(255);
+          c->receive_length = data_length;
+          send_control(ACK, src_ID);
+          start_timer(src_ID);
         }
         break;
       case AEP:
 
-        if(((segment[0]&0x70)>>4) == ACK){
-          stop_timer();
-          status.state = CLIENT_CONNECTED;
-          status.NACK_counter = 0; //Reset when status.state is switched...
-          create_data_segment(status.transmitt_buffer, answer_segment);
-          answer_segment[CONTROL] = (DATA_MESSAGE<<4);
-          add_checksum(answer_segment);
-          transmit_NET(answer_segment, src_ID);
-          start_timer(255);
+        if(((segment[0]&0x70)>>4) == ACK && (segment[CONTROL] & FAST_OPEN)){
+          if(segment[SEGMENT_SEQ] == pbuf_data(c->transmitt_buffer[c->transmitt_head])[SEGMENT_SEQ])
+            end_con(src_ID); //Data delivered and connection closed
+        }
+        else if(((segment[0]&0x70)>>4) == ACK){
+          stop_timer(src_ID);
+          c->state = CLIENT_CONNECTED;
+          c->NACK_counter = 0; //Reset when state is switched...
+          send_data(src_ID);
+          start_timer(src_ID);
         }
         else if(((segment[0]&0x70)>>4) == NACK){
-          stop_timer();
-          if(status.NACK_counter ++ > 10){
-            end_con();
+          STATS_INC(tran_nacks);
+          stop_timer(src_ID);
+          if(c->NACK_counter ++ > 10){
+            end_con(src_ID);
             return;
           }
-          create_dummy_segment(answer_segment);
-          answer_segment[CONTROL] = (CONNECTION_REQ<<4); //Try again; counter!
-          add_checksum(answer_segment);
-          transmit_NET(answer_segment, src_ID);
-          start_timer(255);
+          send_control(CONNECTION_REQ, src_ID); //Try again; counter!
+          start_timer(src_ID);
         }
         break;
       case SERVER_CONNECTED:
 
         if(((segment[0]&0x70)>>4) == DATA_MESSAGE){
-          stop_timer();
-          create_dummy_segment(answer_segment);
-          answer_segment[CONTROL] = (ACK<<4);
-          add_checksum(answer_segment);
-          for(int i = 0;i <APPDATA_SIZE;i ++){
-            status.receive_buffer[i] = segment[i+APP_DATA];
+          stop_timer(src_ID);
+          for(int i = 0;i <data_length;i ++){
+            c->receive_buffer[i] = segment[i+APP_DATA];
           }
-          transmit_NET(answer_segment, src_ID);
-          start_timer(255);
+          c->receive_length = data_length;
+          send_control(ACK, src_ID);
+          start_timer(src_ID);
         }
         else if(((segment[0]&0x70)>>4) == DISCONNECT_REQ){
-          stop_timer();
-          status.state = PDP;
-          create_dummy_segment(answer_segment);
-          answer_segment[CONTROL] = (DISCONNECT_REQ<<4);
-          add_checksum(answer_segment);
-          transmit_NET(answer_segment, src_ID);
-          start_timer(255);
+          stop_timer(src_ID);
+          c->state = PDP;
+          send_control(DISCONNECT_REQ, src_ID);
+          start_timer(src_ID);
         }
         break;
       case CLIENT_CONNECTED:
         if(((segment[0]&0x70)>>4) == ACK){ //Only one data_segment to be sent per connection!
-          stop_timer();
-          status.state = ADP;
-          status.NACK_counter = 0;
-          create_dummy_segment(answer_segment);
-          answer_segment[CONTROL] = (DISCONNECT_REQ<<4);
-          add_checksum(answer_segment);
-          transmit_NET(answer_segment, src_ID);
-          start_timer(255);
+          stop_timer(src_ID);
+          c->state = ADP;
+          c->NACK_counter = 0;
+          send_control(DISCONNECT_REQ, src_ID);
+          start_timer(src_ID);
         }
         else if(((segment[0]&0x70)>>4) == NACK){
-          stop_timer();
-          if(status.NACK_counter ++ > 10){
-            end_con();
+          STATS_INC(tran_nacks);
+          stop_timer(src_ID);
+          if(c->NACK_counter ++ > 10){
+            end_con(src_ID);
             return;
           }
-          create_data_segment(status.transmitt_buffer, answer_segment);
-          answer_segment[CONTROL] = (DATA_MESSAGE<<4);
-          add_checksum(answer_segment);
-          transmit_NET(answer_segment, src_ID);
-          start_timer(255);
+          send_data(src_ID);
+          start_timer(src_ID);
         }
         break;
 
       case PDP:
         if(((segment[0]&0x70)>>4) == ACK){
-          stop_timer();
-          app_layer_receive(status.receive_buffer);
-          end_con();
+          stop_timer(src_ID);
+          app_layer_receive(c->receive_buffer, c->receive_length);
+          end_con(src_ID);
           return;
         }
         break;
 
       case ADP: //SENDING DATA!
         if(((segment[0]&0x70)>>4) == DISCONNECT_REQ){
-          stop_timer();
-          create_dummy_segment(answer_segment);
-          answer_segment[CONTROL] = (ACK<<4);
-          add_checksum(answer_segment);
-          transmit_NET(answer_segment, src_ID);
-          end_con();
+          stop_timer(src_ID);
+          send_control(ACK, src_ID);
+          end_con(src_ID);
         }
         break;
       }
     }
+  else
+    STATS_INC(tran_errors);
   }
 
-void trans_layer_send(uint8_t app_data[], uint8_t ID){
-  if (!status.number_of_data_packages){
-    //status.transmitt_buffer is empty
-    status.transmitt_buffer[0] = ID;
-    for(int i = 0; i < APPDATA_SIZE; i++){
-      status.transmitt_buffer[i+1] = app_data[i];
-    }
-    status.number_of_data_packages++;
-
-    //SEND DATA;
-    uint8_t segment[HEADER_SIZE+APPDATA_SIZE];
+//The LLC ACK of a member further away only comes from the first hop
+uint8_t trans_layer_group_direct(uint8_t dest_ID){
+  return net_group_direct(dest_ID);
+}
 
-    if(status.state == IDLE){
-      status.state = AEP;
-      status.connect_id = ID;
-      connect_to_node(segment);
-      transmit_NET(segment, ID);
-      start_timer(255);
-    return;
-  }
+void trans_layer_send(uint8_t app_data[], uint8_t length, uint8_t dest_ID){
+  trans_layer_send_mode(app_data, length, dest_ID, TRAN_CONNECTION);
 }
-  //BUFFER DATA
-  else if(status.number_of_data_packages == 1){
-    status.transmitt_buffer[APPDATA_SIZE+1] = ID;
-    for(int i = 0; i < APPDATA_SIZE; i++){
-      status.transmitt_buffer[APPDATA_SIZE+i+2] = app_data[i];
-    }
-    status.number_of_data_packages ++;
-  }
-  else if(status.number_of_data_packages == 2){
-    status.transmitt_buffer[2*APPDATA_SIZE+2] = ID;
-    for(int i = 0; i < APPDATA_SIZE; i++){
-      status.transmitt_buffer[2*APPDATA_SIZE+i+3] = app_data[i];
+
+//The segment is only as long as the app data, NET and DLL send no padding
+//A group address (common/group.h) takes one datagram for all its members, the other modes
+//keep state per peer and send every member its own segment
+void trans_layer_send_mode(uint8_t app_data[], uint8_t length, uint8_t dest_ID, uint8_t mode){
+  if (IS_GROUP(dest_ID) && mode != TRAN_DATAGRAM){
+    for (uint8_t i = 0; i < ID_RANGE; i++){
+      if (IN_GROUP(dest_ID, i)) trans_layer_send_mode(app_data, length, i, mode);
     }
-    status.number_of_data_packages++;
+    return;
   }
-  else if (status.number_of_data_packages == 3){
-    status.transmitt_buffer[3*APPDATA_SIZE+3] = ID;
-    for(int i = 0; i < APPDATA_SIZE; i++){
-      status.transmitt_buffer[3*APPDATA_SIZE+i+4] = app_data[i];
-    }
-    status.number_of_data_packages++;
+  if ((dest_ID >= ID_RANGE && !IS_GROUP(dest_ID)) || dest_ID == ID) return;
+  if (length > APPDATA_SIZE) length = APPDATA_SIZE;
+
+  if (mode == TRAN_DATAGRAM){ //Fire and forget, once NET has it the pbuf is not needed
+    pbuf* pb = pbuf_alloc(NET_HEADER_SIZE);
+    if (!pb) return;
+    create_data_segment(app_data, length, pbuf_put(pb, SEGMENT_SIZE(length)), DATAGRAM<<4, 0);
+    transmit_NET(pb, dest_ID);
+    pbuf_free(pb);
+    return;
   }
+  struct Connection* c = &connections[dest_ID];
+  if (c->number_of_data_packages == TRANSMITT_QUEUE_SIZE) return; //Buffer full
+
+  //Build the data segment once, in place, it is resent from here until ACKed
+  pbuf* pb = pbuf_alloc(NET_HEADER_SIZE);
+  if (!pb) return;
+  if (mode == TRAN_RELIABLE_DATAGRAM)
+    create_data_segment(app_data, length, pbuf_put(pb, SEGMENT_SIZE(length)), (DATAGRAM<<4) | DGRAM_ACK_REQ, c->tx_seq++);
+  else if (TRAN_FAST_OPEN)
+    create_data_segment(app_data, length, pbuf_put(pb, SEGMENT_SIZE(length)), (CONNECTION_REQ<<4) | FAST_OPEN, c->tx_seq++);
+  else
+    create_data_segment(app_data, length, pbuf_put(pb, SEGMENT_SIZE(length)), DATA_MESSAGE<<4, 0);
+  c->transmitt_buffer[(c->transmitt_head + c->number_of_data_packages) % TRANSMITT_QUEUE_SIZE] = pb;
+  c->number_of_data_packages++;
+
+  //SEND DATA; otherwise it stays buffered until the connection to dest_ID is free
+  start_next(dest_ID);
 }
 
 
-ISR(TIMER0_COMPA_vect){
-  if(!(expand_timer_counter--)){
-    if(status.timer_counter++ > 2){ //do not try agian...
-      stop_timer();
-      end_con();
-    }
-    uint8_t segment[HEADER_SIZE+APPDATA_SIZE];
-    switch (status.state) {
-      case AEP:
-        //RESEND CONNECT_RQ;
-        connect_to_node(segment);
-        transmit_NET(segment, status.connect_id);
-        break;
-      case PEP:
-        create_dummy_segment(segment);
-        segment[CONTROL] = (ACK<<4);
-        add_checksum(segment);
-        transmit_NET(segment, status.connect_id);
-        break;
-
-      case SERVER_CONNECTED:
-        create_dummy_segment(segment);
-        segment[CONTROL] = (ACK<<4);
-        add_checksum(segment);
-        transmit_NET(segment, status.connect_id);
-        break;
-
-      case CLIENT_CONNECTED:
-        create_data_segment(status.transmitt_buffer, segment);
-        segment[CONTROL] = (DATA_MESSAGE<<4);
-        add_checksum(segment);
-        transmit_NET(segment, status.connect_id);
-        break;
-
-      case PDP:
-        create_dummy_segment(segment);
-        segment[CONTROL] = (DISCONNECT_REQ<<4);
-        add_checksum(segment);
-        transmit_NET(segment, status.connect_id);
-        break;
-
-      case ADP:
-        create_dummy_segment(segment);
-        segment[CONTROL] = (DISCONNECT_REQ<<4);
-        add_checksum(segment);
-        transmit_NET(segment, status.connect_id);
-        break;
-      default:
-        return;
-    }
-    expand_timer_counter = 300;
+//Runs in the main loop, every connection has a timer of its own with the peer as arg
+static void tran_timeout(timer* t){
+  uint8_t peer = t->arg;
+  struct Connection* c = &connections[peer];
+  STATS_INC(tran_timeouts);
+  //A segment that is still queued below has not been lost yet, it does not count as a try
+  uint8_t fast_open = c->state == AEP && (pbuf_data(c->transmitt_buffer[c->transmitt_head])[CONTROL] & FAST_OPEN);
+  uint8_t waiting = (c->state == CLIENT_CONNECTED || c->state == DGRAM_PENDING || fast_open) && c->transmitt_buffer[c->transmitt_head]->ref > 1;
+  if(!waiting && c->timer_counter++ > 2){ //do not try agian...
+    end_con(peer);
+    return;
+  }
+  switch (c->state) {
+    case AEP:
+      //RESEND CONNECT_RQ;
+      if(fast_open) send_data(peer);
+      else send_connect(peer);
+      break;
+    case PEP:
+      send_control(ACK, peer);
+      break;
+
+    case SERVER_CONNECTED:
+      send_control(ACK, peer);
+      break;
+
+    case CLIENT_CONNECTED:
+      send_data(peer);
+      break;
+
+    case PDP:
+      send_control(DISCONNECT_REQ, peer);
+      break;
+
+    case ADP:
+      send_control(DISCONNECT_REQ, peer);
+      break;
+
+    case DGRAM_PENDING:
+      send_data(peer);
+      break;
+    default:
+      return;
   }
+  start_timer(peer);
 }
@@ -1,21 +1,38 @@
+#ifndef TRAN_H
+#define TRAN_H
+
 #include <stdint.h>
 #include <stdlib.h>
-#include "../APP/APP.h"
+#include "../5_APP/APP.h"
+#include "../common/pbuf.h"
+#include "../common/integrity.h"
+#include "../common/timer.h"
 
 #define HEADER_SIZE 7
 #define CONTROL 0 //Two bytes
 #define SEQUENCE_NUMBER
 #define SRC_PORT 2
 #define DEST_PORT 3
-#define LENGTH 4
-#define APP_DATA 5 //114 Bytes
-#define CHECKSUM 119
+#define LENGTH 4 //Bytes in the segment, header and checksum included
+#define APP_DATA 5 //0 to 113 Bytes, the two checksum bytes follow the last one
+#define SEGMENT_SIZE(data_length) ((data_length) + HEADER_SIZE)
 
 #define DATA_MESSAGE 0
 #define ACK 1
 #define NACK 2
 #define CONNECTION_REQ 3
 #define DISCONNECT_REQ 5
+#define DATAGRAM 6 //Connectionless, delivered on arrival
+#define DATAGRAM_ACK 7 //Echoes the sequence number of a DATAGRAM with DGRAM_ACK_REQ
+
+#define DGRAM_ACK_REQ 0x08 //CONTROL flag, sender waits for a DATAGRAM_ACK and resends
+#define FAST_OPEN 0x04 //CONTROL flag, CONNECTION_REQ carries the data and the ACK to it closes the connection
+#define SEGMENT_SEQ (CONTROL + 1) //Sequence number of a reliable datagram or fast open, drops resent copies
+
+//Send modes of trans_layer_send_mode()
+#define TRAN_CONNECTION 0 //Handshake, data and disconnect, every step ACKed
+#define TRAN_DATAGRAM 1 //One segment, no ACK
+#define TRAN_RELIABLE_DATAGRAM 2 //One segment and one ACK, resent until ACKed
 
 //STATES
 #define IDLE 0
@@ -25,26 +42,46 @@
 #define SERVER_CONNECTED 4
 #define PDP 5 //Passive Disconnect pending
 #define ADP 6 //Active Disconnect Pending
+#define DGRAM_PENDING 7 //Reliable datagram sent, waiting for its DATAGRAM_ACK
+
+#define TRANSMITT_QUEUE_SIZE 4 //Data segments per peer waiting for a connection
+#define TRAN_TIMEOUT TIMER_MS(6550) //Before a segment is resent
+#define DGRAM_TIMEOUT TIMER_MS(1005) //A datagram only waits for one round trip
+
+//Connections send the data with the CONNECTION_REQ, 1 RTT instead of 3
+#ifndef TRAN_FAST_OPEN
+#define TRAN_FAST_OPEN 1
+#endif
 
-#define VARIABLE_APP_DATA_LENGTH 0
 #define USE_SEQUENCE_NUMBER 0
 
-struct Status {
+//One entry per peer, every connection runs its own state machine and timer
+struct Connection {
   uint8_t state;
-  uint8_t timer_counter;
+  uint8_t timer_counter; //Timeouts in a row
   uint8_t NACK_counter;
+  timer retransmit; //Resends the segment or gives up, arg = peer
   uint8_t receive_buffer[APPDATA_SIZE]; //Only one can be received per connection.
-  uint8_t transmitt_buffer[4*APPDATA_SIZE + 4]; //FIXED BUFFER SIZE FOR THIS APPLICATION! on form [ID, appdata, ID, appdata, ...] Maximum 4 ID's plus corresponding app-data.
+  uint8_t receive_length; //Bytes of app data in receive_buffer
+  pbuf* transmitt_buffer[TRANSMITT_QUEUE_SIZE]; //Ring of data segments built in place, with headroom for NET
+  uint8_t transmitt_head; //[transmitt_head] is the one being sent
   uint8_t number_of_data_packages;
-  int connect_id;
+  uint8_t tx_seq; //Sequence number of the next reliable datagram or fast open to the peer
+  uint8_t rx_seq; //Sequence number of the last one delivered from the peer
+  uint8_t rx_seq_valid; //rx_seq is valid
 };
 
-void trans_layer_send(uint8_t app_data[], uint8_t ID);
+//Only the first length bytes of app_data are sent, at most APPDATA_SIZE
+void trans_layer_send(uint8_t app_data[], uint8_t length, uint8_t dest_ID); //TRAN_CONNECTION
+void trans_layer_send_mode(uint8_t app_data[], uint8_t length, uint8_t dest_ID, uint8_t mode); //dest_ID may be a group
+uint8_t trans_layer_group_direct(uint8_t dest_ID); //1 if a group datagram is ACKed by every member on the LLC
 void init_transport_layer(void);
-void transport_layer_receive(uint8_t segment[], uint8_t src_ID);
+void transport_layer_receive(uint8_t segment[], uint8_t length, uint8_t src_ID); //length = bytes NET received
 //struct Segment seg;
 
 //testing
 void create_dummy_segment(uint8_t segment[]);
 void add_checksum(uint8_t segment[]);
 void response(int type);
+
+#endif
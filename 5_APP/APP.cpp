@@ -1,21 +1,51 @@
 #include "APP.h"
-#include "TRAN.h"
+#include "../4_TRAN/TRAN.h"
+#include "../common/event.h"
+#include "../common/timer.h"
+#include "../common/sram.h"
+#include "../common/group.h"
 #include "../application/application.h"
-#include "../application/config.h"
+#include "config.h"
 #define PAD_VALUE 0
 #define TEST 1
 
+//Button events go over a connection unless the build picks a datagram mode, e.g.
+//-DAPP_SEND_MODE=TRAN_RELIABLE_DATAGRAM delivers one with a single ACK
+#ifndef APP_SEND_MODE
+#define APP_SEND_MODE TRAN_CONNECTION
+#endif
+
+//An event for several lights goes out once to a group address, the LLC ACKs of
+//every member stand in for the TRAN ACK. That only holds while every member is a
+//neighbour, a group with members further away is sent APP_SEND_MODE to each member
+#ifndef APP_GROUP_MODE
+#define APP_GROUP_MODE TRAN_DATAGRAM
+#endif
+
+//One batch of (button, button_count) pairs per destination, sent once the
+//coalescing window is over or APP_BATCH_SIZE pairs are waiting
+typedef struct app_batch{
+  uint8_t dest;
+  uint8_t pairs; //0 = slot free
+  timer flush; //Runs from the first pair until the batch is sent
+  uint8_t app_data[APPDATA_SIZE];
+}app_batch;
+
+static app_batch batches[APP_BATCH_SLOTS];
+static void app_flush(timer* t);
+
 void pad_array(uint8_t array[], uint8_t start_index){
   for (int i = start_index; i<APPDATA_SIZE; i++){
     array[i] = PAD_VALUE;
   }
 }
 
-void app_layer_receive(uint8_t app_data[]){
+//length bytes of (button, button_count) pairs, a shorter list ends with PAD_VALUE
+void app_layer_receive(uint8_t app_data[], uint8_t length){
    uint8_t i = 0;
    uint8_t button;
    uint8_t button_count;
-  while (app_data[i] != PAD_VALUE){ //PAD_VALUE){
+  while (i + 1 < length && app_data[i] != PAD_VALUE){ //PAD_VALUE){
     button = app_data[i];
     button_count = app_data[i+1];
     i+=2;
@@ -23,33 +53,77 @@ void app_layer_receive(uint8_t app_data[]){
   }
 }
 
+void init_app_layer(void){
+  for (uint8_t i = 0; i < APP_BATCH_SLOTS; i++){
+    batches[i].pairs = 0;
+    timer_setup(&batches[i].flush, app_flush, i);
+  }
+  sram_budget(SRAM_APP, sizeof(batches));
+}
+
+static void send_batch(app_batch* b){
+  uint8_t mode = (IS_GROUP(b->dest) && trans_layer_group_direct(b->dest)) ? APP_GROUP_MODE : APP_SEND_MODE;
+  timer_stop(&b->flush);
+  trans_layer_send_mode(b->app_data, 2*b->pairs, b->dest, mode); //Only the pairs, no padding
+  b->pairs = 0;
+}
+
+static void app_flush(timer* t){
+  app_batch* b = &batches[t->arg];
+  if (b->pairs) send_batch(b);
+}
+
+void app_event(uint8_t button, uint8_t button_count, uint8_t dest_ID){
+  app_batch* b = 0;
+  for (uint8_t i = 0; i < APP_BATCH_SLOTS; i++){
+    if (batches[i].pairs && batches[i].dest == dest_ID) b = &batches[i];
+  }
+  if (!b){ //New batch, in a free slot or in the one closest to being sent
+    b = &batches[0];
+    for (uint8_t i = 0; i < APP_BATCH_SLOTS; i++){
+      if (!batches[i].pairs){
+        b = &batches[i];
+        break;
+      }
+      if (timer_left(&batches[i].flush) < timer_left(&b->flush)) b = &batches[i];
+    }
+    if (b->pairs) send_batch(b);
+    b->dest = dest_ID;
+  }
+
+  #if APP_COMPACT
+  //The newest count of a button supersedes the one still waiting
+  for (uint8_t i = 0; i < 2*b->pairs; i += 2){
+    if (b->app_data[i] == button){
+      b->app_data[i+1] = button_count;
+      return;
+    }
+  }
+  #endif
+
+  b->app_data[2*b->pairs] = button;
+  b->app_data[2*b->pairs + 1] = button_count;
+  if (b->pairs++ == 0) timer_start(&b->flush, APP_BATCH_WINDOW);
+  if (b->pairs == APP_BATCH_SIZE) send_batch(b);
+}
+
 void app_layer_send(void){
-  uint8_t app_data[APPDATA_SIZE];
   #if TEST
   //NODE_ID == 3
   if(switch_count_val() == 0){
     increment_switch_counter();
-    app_data[0] = switch_2;
-    app_data[1] = switch_count_val();
-    pad_array(app_data, 2);
-    trans_layer_send(app_data, NODE_ID_2);
+    app_event(switch_2, switch_count_val(), NODE_ID_2);
 
   }
   else if (switch_count_val() == 1){
     increment_switch_counter();
-      app_data[0] = switch_2;
-      app_data[1] = switch_count_val();
-      pad_array(app_data, 2);
-      trans_layer_send(app_data, NODE_ID_2);
+      app_event(switch_2, switch_count_val(), NODE_ID_2);
 
     }
 
   else if (switch_count_val() == 2){
       increment_switch_counter();
-      app_data[0] = switch_2;
-      app_data[1] = switch_count_val();
-      pad_array(app_data, 2);
-      trans_layer_send(app_data, NODE_ID_2);
+      app_event(switch_2, switch_count_val(), NODE_ID_2);
       reset_switch_counter();
     }
   return;
@@ -58,53 +132,33 @@ void app_layer_send(void){
   #if NODE_ID == NODE_ID_3
   if(switch_count_val() == 0){
     increment_switch_counter();
-    app_data[0] = switch_2;
-    app_data[1] = switch_count_val();
-    pad_array(app_data, 2);
-    trans_layer_send(app_data, NODE_ID_1);
+    app_event(switch_2, switch_count_val(), NODE_ID_1);
 
   }
 
   else if (switch_count_val() == 1){
     increment_switch_counter();
-    app_data[0] = switch_2;
-    app_data[1] = switch_count_val();
-    pad_array(app_data, 2);
-    trans_layer_send(app_data, NODE_ID_2);
+    app_event(switch_2, switch_count_val(), NODE_ID_2);
   }
 
   else if (switch_count_val() == 2){
     increment_switch_counter();
-    app_data[0] = switch_2;
-    app_data[1] = switch_count_val();
-    pad_array(app_data, 2);
-    trans_layer_send(app_data, NODE_ID_2);
-    trans_layer_send(app_data, NODE_ID_1);
+    app_event(switch_2, switch_count_val(), GROUP_OF((1 << NODE_ID_1) | (1 << NODE_ID_2)));
     reset_switch_counter();
   }
 
   #elif NODE_ID == NODE_ID_2
   if(switch_count_val() == 0){
     increment_switch_counter();
-    app_data[0] = SWITCH_1;
-    app_data[1] = switch_count_val();
-    pad_array(app_data, 2);
-    trans_layer_send(app_data, NODE_ID_1);
+    app_event(SWITCH_1, switch_count_val(), NODE_ID_1);
   }
   else if (switch_count_val() == 1){
     increment_switch_counter();
-    app_data[0] = SWITCH_1;
-    app_data[1] = switch_count_val();
-    pad_array(app_data, 2);
-    trans_layer_send(app_data, NODE_ID_3);
+    app_event(SWITCH_1, switch_count_val(), NODE_ID_3);
   }
   else if (switch_count_val() == 2){
     increment_switch_counter();
-    app_data[0] = SWITCH_1;
-    app_data[1] = switch_count_val();
-    pad_array(app_data, 2);
-    trans_layer_send(app_data, NODE_ID_3);
-    trans_layer_send(app_data, NODE_ID_1);
+    app_event(SWITCH_1, switch_count_val(), GROUP_OF((1 << NODE_ID_1) | (1 << NODE_ID_3)));
     reset_switch_counter();
   }
   #endif
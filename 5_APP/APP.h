@@ -1,9 +1,24 @@
 #include <stdint.h>
 #include <stdlib.h>
 
-#define APPDATA_SIZE 114
+#define APPDATA_SIZE 113
+
+//Switch events for the same destination are collected for a short window and
+//sent as one segment
+#ifndef APP_BATCH_MS
+#define APP_BATCH_MS 100 //Coalescing window
+#endif
+#define APP_BATCH_WINDOW TIMER_MS(APP_BATCH_MS)
+#define APP_BATCH_SIZE 8 //Pairs per segment, a full batch is sent at once
+#define APP_BATCH_SLOTS 3 //Destinations with a batch waiting
+
+#ifndef APP_COMPACT
+#define APP_COMPACT 1 //Keep only the newest count of each button in a batch
+#endif
 
 void app_layer_send(void);
-void app_layer_receive(uint8_t app_data[]);
+void app_layer_receive(uint8_t app_data[], uint8_t length);
 void pad_array(uint8_t app_data[], uint8_t start_index);
 void event_received(uint8_t button, uint8_t button_count);
+void init_app_layer(void);
+void app_event(uint8_t button, uint8_t button_count, uint8_t dest_ID); //Queue one switch event
@@ -1,6 +1,6 @@
 #include <stdint.h>
 #include <stdlib.h>
-#include "config.h"
+#include "../5_APP/config.h"
 
 #if NODE_ID != NODE_ID_1
 void increment_switch_counter(void);
@@ -0,0 +1,293 @@
+#include <util/delay.h>
+#include <util/atomic.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+#include "../rfm12lib/rfm12.h"
+#include "../1_PHY/PHY.h"
+#include "../2_1_MAC/csma.h"
+#include "../2_2_LLC/LLC.h"
+#include "../3_NET/NET.h"
+#include "../4_TRAN/TRAN.h"
+#include "../common/pbuf.h"
+#include "../common/timer.h"
+#include "../common/stats.h"
+#include "../common/sram.h"
+
+#if !STATS
+#error "the benchmark takes the frame counts from common/stats.h"
+#endif
+
+typedef struct bench_config{
+  uint8_t scenario;
+  uint8_t dest;
+  uint8_t size;
+  uint16_t count;
+  uint16_t interval_ms;
+}bench_config;
+
+//Request waiting for its answer
+typedef struct bench_flight{
+  uint8_t used;
+  uint8_t seq;
+  uint16_t sent; //timer_now() when it was handed to TRAN
+}bench_flight;
+
+static bench_config cfg = {BENCH_MODE, BENCH_DEST, BENCH_SIZE, BENCH_COUNT, BENCH_INTERVAL_MS};
+static bench_flight flight[BENCH_WINDOW];
+static uint8_t running;
+static uint16_t sent, answered, lost;
+static uint32_t app_bytes; //Of the requests answered
+static uint32_t run_ticks; //Since the run started, added up so it does not wrap
+static uint16_t last_now;
+static uint32_t radio_bytes; //Frame bytes sent and received since the run started
+static uint16_t bytes_last; //stats bytes_tx + bytes_rx when they were last added up
+static uint16_t rtt[BENCH_SAMPLES];
+static uint8_t samples;
+static uint16_t bench_seed;
+static timer send_timer; //Paces pings and events
+static timer check_timer; //Gives up requests without answer
+
+static uint16_t bench_rand(void){
+  bench_seed ^= bench_seed << 7;
+  bench_seed ^= bench_seed >> 9;
+  bench_seed ^= bench_seed << 8;
+  return bench_seed;
+}
+
+//Exponentially distributed gap with the given mean, -ln(U) from the position of the
+//leading one of U and a straight line between the powers of two (error < 9%)
+static uint16_t exp_gap(uint16_t mean){
+  uint16_t u = bench_rand();
+  if (!u) u = 1;
+  uint8_t k = 0;
+  while (!(u & 0x8000)){
+    u <<= 1;
+    k++;
+  }
+  uint16_t e = (uint16_t)(k + 1) * 256 - ((u - 0x8000) >> 7); //-log2(U), 8 fraction bits
+  uint32_t gap = (uint32_t) mean * e * 177 >> 16; //ln 2 = 177/256
+  return gap ? gap : 1;
+}
+
+static void print(const char *fmt, ...);
+
+static uint8_t request_mode(uint8_t scenario){
+  return scenario == BENCH_NET_PING ? TRAN_DATAGRAM : TRAN_RELIABLE_DATAGRAM;
+}
+
+static uint16_t to_ms(uint32_t ticks){
+  return ticks * TIMER_TICK_US / 1000;
+}
+
+static void report(void){
+  running = 0;
+  timer_stop(&send_timer);
+  timer_stop(&check_timer);
+
+  //Insertion sort, at most BENCH_SAMPLES round trips
+  for (uint8_t i = 1; i < samples; i++){
+    uint16_t v = rtt[i];
+    uint8_t j = i;
+    for (; j && rtt[j-1] > v; j--) rtt[j] = rtt[j-1];
+    rtt[j] = v;
+  }
+  uint16_t p50 = samples ? to_ms(rtt[(samples - 1) / 2]) : 0;
+  uint16_t p99 = samples ? to_ms(rtt[(uint16_t)(samples - 1) * 99 / 100]) : 0;
+  uint32_t us = run_ticks * TIMER_TICK_US;
+  uint32_t goodput = us ? app_bytes * 1000000 / us : 0;
+  uint32_t efficiency = radio_bytes ? app_bytes * 1000 / radio_bytes : 0;
+
+  print("BENCH m%u sent=%u answered=%u lost=%u goodput=%luB/s eff=%lu/1000 p50=%ums p99=%ums\n\r",
+      cfg.scenario, sent, answered, lost, (unsigned long) goodput, (unsigned long) efficiency, p50, p99);
+}
+
+static void update_clock(void){
+  uint16_t now = timer_now();
+  run_ticks += (uint16_t)(now - last_now);
+  last_now = now;
+  uint16_t bytes = stats.bytes_tx + stats.bytes_rx; //Added up at least every BENCH_CHECK, long before they wrap
+  radio_bytes += (uint16_t)(bytes - bytes_last);
+  bytes_last = bytes;
+}
+
+static void finish_if_done(void){
+  update_clock();
+  if (answered + lost == cfg.count) report();
+}
+
+//Hand the next request to TRAN, 0 if the window is full or the run has sent all
+static uint8_t send_request(void){
+  if (sent == cfg.count) return 0;
+  bench_flight* f = 0;
+  for (uint8_t i = 0; i < BENCH_WINDOW; i++){
+    if (!flight[i].used){
+      f = &flight[i];
+      break;
+    }
+  }
+  if (!f) return 0;
+
+  uint8_t msg[APPDATA_SIZE];
+  uint16_t now = timer_now();
+  memset(msg, 0x55, cfg.size);
+  msg[BENCH_TYPE] = BENCH_REQUEST;
+  msg[BENCH_SCENARIO] = cfg.scenario;
+  msg[BENCH_SRC] = ID;
+  msg[BENCH_SEQ] = sent;
+  msg[BENCH_SENT] = now >> 8;
+  msg[BENCH_SENT + 1] = now;
+  f->used = 1;
+  f->seq = sent;
+  f->sent = now;
+  sent++;
+  trans_layer_send_mode(msg, cfg.size, cfg.dest, request_mode(cfg.scenario));
+  return 1;
+}
+
+static void send_next(timer* t){
+  if (cfg.scenario == BENCH_EVENTS){
+    if (!send_request() && sent < cfg.count){ //Window full, the event is lost like a dropped button press
+      sent++;
+      lost++;
+      finish_if_done();
+    }
+    if (running && sent < cfg.count) timer_start(&send_timer, exp_gap(TIMER_MS(cfg.interval_ms)));
+  }
+  else{
+    send_request();
+    if (sent < cfg.count) timer_start(&send_timer, TIMER_MS(cfg.interval_ms));
+  }
+}
+
+static void check_flight(timer* t){
+  uint16_t now = timer_now();
+  for (uint8_t i = 0; i < BENCH_WINDOW; i++){
+    if (flight[i].used && (uint16_t)(now - flight[i].sent) >= BENCH_TIMEOUT){
+      flight[i].used = 0;
+      lost++;
+      if (cfg.scenario == BENCH_BULK) send_request();
+    }
+  }
+  finish_if_done();
+  if (running) timer_start(&check_timer, BENCH_CHECK);
+}
+
+static void bench_start(void){
+  for (uint8_t i = 0; i < BENCH_WINDOW; i++) flight[i].used = 0;
+  sent = answered = lost = 0;
+  app_bytes = 0;
+  run_ticks = 0;
+  samples = 0;
+  last_now = timer_now();
+  radio_bytes = 0;
+  bytes_last = stats.bytes_tx + stats.bytes_rx;
+  running = 1;
+  timer_start(&check_timer, BENCH_CHECK);
+  if (cfg.scenario == BENCH_BULK)
+    while (send_request());
+  else
+    send_next(&send_timer);
+}
+
+//Requests are answered whatever this node is doing, answers end a round trip
+void app_layer_receive(uint8_t app_data[], uint8_t length){
+  if (length < BENCH_HEADER) return;
+  if (app_data[BENCH_TYPE] == BENCH_REQUEST){
+    uint8_t answer[BENCH_HEADER];
+    memcpy(answer, app_data, BENCH_HEADER);
+    answer[BENCH_TYPE] = BENCH_ANSWER;
+    answer[BENCH_SRC] = ID;
+    trans_layer_send_mode(answer, BENCH_HEADER, app_data[BENCH_SRC], request_mode(app_data[BENCH_SCENARIO]));
+    return;
+  }
+  if (app_data[BENCH_TYPE] != BENCH_ANSWER || !running) return;
+  for (uint8_t i = 0; i < BENCH_WINDOW; i++){
+    if (flight[i].used && flight[i].seq == app_data[BENCH_SEQ]){
+      flight[i].used = 0;
+      uint16_t ticks = timer_now() - flight[i].sent;
+      if (samples < BENCH_SAMPLES) rtt[samples++] = ticks;
+      answered++;
+      app_bytes += cfg.size;
+      if (cfg.scenario == BENCH_BULK) send_request();
+      finish_if_done();
+      return;
+    }
+  }
+}
+
+static void print(const char *fmt, ...){
+  char text[96];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(text, sizeof(text), fmt, args);
+  va_end(args);
+  put_str(text);
+}
+
+static void command(char *line){
+  uint16_t value = atoi(line + 1);
+  switch (line[0]){
+    case 'm': if (value <= BENCH_EVENTS) cfg.scenario = value; break;
+    case 'd': if (value < ID_RANGE && value != ID) cfg.dest = value; break;
+    case 's': if (value >= BENCH_HEADER && value <= APPDATA_SIZE) cfg.size = value; break;
+    case 'n': if (value) cfg.count = value; break;
+    case 'i': if (value) cfg.interval_ms = value; break;
+    case 'g': if (!running) bench_start(); return;
+    case 'x': if (running) report(); return;
+    case 'S': stats_dump(); return;
+    case 'M': sram_report(); return;
+    case '?': break;
+    default: put_str("m d s n i g x S M ?\n\r"); return;
+  }
+  print("m%u d%u s%u n%u i%u\n\r", cfg.scenario, cfg.dest, cfg.size, cfg.count, cfg.interval_ms);
+}
+
+void bench_poll(void){
+  static char line[12];
+  static uint8_t len;
+  char ch = 0;
+  while (poll_ch(&ch)){
+    if (ch == '\r' || ch == '\n'){
+      line[len] = 0;
+      if (len) command(line);
+      len = 0;
+    }
+    else if (len < sizeof(line) - 1) line[len++] = ch;
+  }
+}
+
+void init_bench(void){
+  bench_seed = 0x1D2B ^ (ID * 0x0101);
+  timer_setup(&send_timer, send_next, 0);
+  timer_setup(&check_timer, check_flight, 0);
+  sram_budget(SRAM_APP, sizeof(flight) + sizeof(rtt));
+  if (BENCH_AUTORUN) bench_start();
+}
+
+#ifndef __PLATFORM_SIM__
+int main() {
+  init_uart0();
+  sram_init();
+  _delay_ms(100);
+  rfm12_init();
+  _delay_ms(100);
+  sei();
+
+  timer_init();
+  csma_init();
+  init_DLL();
+  init_NET();
+  init_transport_layer();
+  init_bench();
+  put_str("bench ready\n\r");
+
+  while(1){
+    poll_PHY();
+    event_dispatch();
+    bench_poll();
+  }
+}
+#endif
@@ -0,0 +1,61 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+//Benchmark firmware, takes the place of 5_APP and application/ (make BENCH=1)
+//Every node running it answers the requests of the others, the node told to run a
+//scenario over the UART sends them and reports goodput, airtime efficiency and
+//the p50/p99 round trip once every request was answered or given up.
+
+//Scenarios
+#define BENCH_NET_PING 0 //One small datagram at a time and its answer, NET and LLC only
+#define BENCH_TRAN_PING 1 //Same with reliable datagrams, TRAN ACKs and resends included
+#define BENCH_BULK 2 //BENCH_WINDOW reliable datagrams in flight at all times
+#define BENCH_EVENTS 3 //Reliable datagrams at Poisson arrivals, mean gap the interval
+
+//Defaults, changed over the UART before a run
+#ifndef BENCH_MODE
+#define BENCH_MODE BENCH_TRAN_PING
+#endif
+#ifndef BENCH_DEST
+#define BENCH_DEST 1
+#endif
+#ifndef BENCH_SIZE
+#define BENCH_SIZE 16 //App bytes per request, BENCH_HEADER .. APPDATA_SIZE
+#endif
+#ifndef BENCH_COUNT
+#define BENCH_COUNT 100 //Requests per run
+#endif
+#ifndef BENCH_INTERVAL_MS
+#define BENCH_INTERVAL_MS 200 //Between pings, mean gap of the events
+#endif
+#ifndef BENCH_AUTORUN
+#define BENCH_AUTORUN 0 //1 = run the default scenario after reset, no UART needed
+#endif
+
+#define BENCH_WINDOW 3 //Requests in flight, below TRANSMITT_QUEUE_SIZE
+#define BENCH_TIMEOUT TIMER_MS(10000) //Request given up without an answer, longer than the TRAN retries
+#define BENCH_CHECK TIMER_MS(100) //Period of the timeout check
+#define BENCH_SAMPLES 128 //Round trips kept for the percentiles, the first ones of a run
+
+//Request and answer, in front of the filler bytes
+#define BENCH_TYPE 0
+#define BENCH_SCENARIO 1
+#define BENCH_SRC 2
+#define BENCH_SEQ 3
+#define BENCH_SENT 4 //timer_now() of the sender, MSB first, returned in the answer
+#define BENCH_HEADER 6
+
+#define BENCH_REQUEST 0xB1
+#define BENCH_ANSWER 0xB2
+
+//UART commands, one per line: a letter and a number
+//m<scenario> d<dest> s<size> n<count> i<interval ms>, g starts, x stops, ? prints
+//the settings, S dumps the statistics of common/stats.h and M reports the SRAM use
+//of common/sram.h
+
+void init_bench(void);
+void bench_poll(void); //From the main loop, reads the UART
+
+#endif
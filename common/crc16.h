@@ -0,0 +1,23 @@
+#ifndef CRC16_H
+#define CRC16_H
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+#define CRC16_INIT 0xFFFF   // Start value of every CRC (CRC-16/CCITT-FALSE)
+
+// Table driven CRC-16/CCITT (polynomial 0x1021, MSB first, no final xor)
+// The CRC is carried by the caller and updated one byte at a time, so it can run
+// while a frame is written or received instead of in a second pass over the data.
+// Stored MSB first behind the data it covers, the CRC over data and CRC together is
+// 0, which lets a receiver that has run the CRC over every byte check it without
+// knowing where the data ends.
+extern const uint16_t crc16_table[256] PROGMEM;
+
+static inline uint16_t crc16_update(uint16_t crc, uint8_t data){
+    return (crc << 8) ^ pgm_read_word(&crc16_table[(uint8_t)(crc >> 8) ^ data]);
+}
+
+uint16_t crc16_block(uint16_t crc, const uint8_t* data, uint8_t len);  // crc16_update() over len bytes
+
+#endif
@@ -0,0 +1,51 @@
+#include "event.h"
+#include <util/atomic.h>
+
+static event events[EVENT_QUEUE_SIZE];
+static uint8_t ev_head;
+static volatile uint8_t ev_count;
+static event_handler handlers[EV_TYPES];
+
+
+void event_subscribe(uint8_t type, event_handler handler){
+    if(type < EV_TYPES)
+        handlers[type] = handler;
+}
+
+uint8_t event_post(uint8_t type, uint8_t arg, pbuf* pb){
+    uint8_t full = 1;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        if(ev_count < EVENT_QUEUE_SIZE){
+            event* e = &events[(ev_head + ev_count) & (EVENT_QUEUE_SIZE - 1)];
+            e->type = type;
+            e->arg = arg;
+            e->pb = pb;
+            if(pb)
+                pb->ref++;      // Inside the atomic block already, same as pbuf_ref()
+            ev_count++;
+            full = 0;
+        }
+    }
+    return full;
+}
+
+uint8_t event_dispatch(void){
+    event e;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        if(ev_count){
+            e = events[ev_head];
+            ev_head = (ev_head + 1) & (EVENT_QUEUE_SIZE - 1);
+            ev_count--;
+        }
+        else
+            e.type = EV_TYPES;
+    }
+    if(e.type == EV_TYPES)
+        return 0;
+    if(handlers[e.type])
+        handlers[e.type](&e);
+    pbuf_free(e.pb);
+    return 1;
+}
@@ -0,0 +1,35 @@
+#ifndef EVENT_H
+#define EVENT_H
+
+#include <stdint.h>
+#include "pbuf.h"
+
+#define EVENT_QUEUE_SIZE 16 // Events waiting for the main loop, a power of 2
+
+// Events passed between the layers
+enum{
+    EV_FRAME_READY,         // PHY: radio holds a received frame
+    EV_ACK_RECEIVED,        // LLC: ACK for the packet being sent, arg = ACK field
+    EV_TX_READY,            // MAC: room in the transmit queue again
+    EV_PACKET_RECEIVED,     // LLC: packet reassembled, pb = NET packet
+    EV_TIMER,               // Timer wheel: a slot with timers came round
+    EV_TYPES
+};
+
+typedef struct event{
+    uint8_t type;
+    uint8_t arg;
+    pbuf* pb;               // Packet carried by the event, 0 if none
+}event;
+
+typedef void (*event_handler)(event* e);
+
+// Run-to-completion event queue
+// Layers post events instead of calling into the next layer, the main loop runs them
+// one at a time and no handler waits for another layer. Events may be posted from ISRs.
+// A posted pbuf is held with its own reference until the handler has returned.
+void event_subscribe(uint8_t type, event_handler handler);  // One handler per event type
+uint8_t event_post(uint8_t type, uint8_t arg, pbuf* pb);    // 1 if queue full, event dropped
+uint8_t event_dispatch(void);                               // Run next event, 0 if none waiting
+
+#endif
@@ -0,0 +1,28 @@
+#include "fec.h"
+
+// Code byte of every nibble d4..d1: bit 0 p1, 1 p2, 2 d1, 3 p4, 4 d2, 5 d3, 6 d4, 7 parity over bits 0..6
+const uint8_t fec_encode_table[16] PROGMEM = {
+    0x00, 0x87, 0x99, 0x1E, 0xAA, 0x2D, 0x33, 0xB4,
+    0x4B, 0xCC, 0xD2, 0x55, 0xE1, 0x66, 0x78, 0xFF
+};
+
+// Nibble of every received byte: the Hamming syndrome points at the wrong bit when the
+// overall parity is odd, a syndrome with even parity means two bits are wrong
+const uint8_t fec_decode_table[256] PROGMEM = {
+    0x00, 0x10, 0x10, 0x80, 0x10, 0x80, 0x80, 0x11, 0x10, 0x80, 0x80, 0x18, 0x80, 0x15, 0x13, 0x80,
+    0x10, 0x80, 0x80, 0x16, 0x80, 0x1B, 0x13, 0x80, 0x80, 0x12, 0x13, 0x80, 0x13, 0x80, 0x03, 0x13,
+    0x10, 0x80, 0x80, 0x16, 0x80, 0x15, 0x1D, 0x80, 0x80, 0x15, 0x14, 0x80, 0x15, 0x05, 0x80, 0x15,
+    0x80, 0x16, 0x16, 0x06, 0x17, 0x80, 0x80, 0x16, 0x1E, 0x80, 0x80, 0x16, 0x80, 0x15, 0x13, 0x80,
+    0x10, 0x80, 0x80, 0x18, 0x80, 0x1B, 0x1D, 0x80, 0x80, 0x18, 0x18, 0x08, 0x19, 0x80, 0x80, 0x18,
+    0x80, 0x1B, 0x1A, 0x80, 0x1B, 0x0B, 0x80, 0x1B, 0x1E, 0x80, 0x80, 0x18, 0x80, 0x1B, 0x13, 0x80,
+    0x80, 0x1C, 0x1D, 0x80, 0x1D, 0x80, 0x0D, 0x1D, 0x1E, 0x80, 0x80, 0x18, 0x80, 0x15, 0x1D, 0x80,
+    0x1E, 0x80, 0x80, 0x16, 0x80, 0x1B, 0x1D, 0x80, 0x0E, 0x1E, 0x1E, 0x80, 0x1E, 0x80, 0x80, 0x1F,
+    0x10, 0x80, 0x80, 0x11, 0x80, 0x11, 0x11, 0x01, 0x80, 0x12, 0x14, 0x80, 0x19, 0x80, 0x80, 0x11,
+    0x80, 0x12, 0x1A, 0x80, 0x17, 0x80, 0x80, 0x11, 0x12, 0x02, 0x80, 0x12, 0x80, 0x12, 0x13, 0x80,
+    0x80, 0x1C, 0x14, 0x80, 0x17, 0x80, 0x80, 0x11, 0x14, 0x80, 0x04, 0x14, 0x80, 0x15, 0x14, 0x80,
+    0x17, 0x80, 0x80, 0x16, 0x07, 0x17, 0x17, 0x80, 0x80, 0x12, 0x14, 0x80, 0x17, 0x80, 0x80, 0x1F,
+    0x80, 0x1C, 0x1A, 0x80, 0x19, 0x80, 0x80, 0x11, 0x19, 0x80, 0x80, 0x18, 0x09, 0x19, 0x19, 0x80,
+    0x1A, 0x80, 0x0A, 0x1A, 0x80, 0x1B, 0x1A, 0x80, 0x80, 0x12, 0x1A, 0x80, 0x19, 0x80, 0x80, 0x1F,
+    0x1C, 0x0C, 0x80, 0x1C, 0x80, 0x1C, 0x1D, 0x80, 0x80, 0x1C, 0x14, 0x80, 0x19, 0x80, 0x80, 0x1F,
+    0x80, 0x1C, 0x1A, 0x80, 0x17, 0x80, 0x80, 0x1F, 0x1E, 0x80, 0x80, 0x1F, 0x80, 0x1F, 0x1F, 0x0F
+};
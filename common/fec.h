@@ -0,0 +1,31 @@
+#ifndef FEC_H
+#define FEC_H
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+#define FEC_CORRECTED 0x10  // fec_decode(): a bit was wrong and has been flipped back
+#define FEC_FAILED 0x80     // fec_decode(): two bits or more wrong, the byte is lost
+
+// Extended Hamming(8,4) code, one code byte per nibble
+// 4 data bits, 3 Hamming parity bits and a parity bit over all 8, so any single bit
+// error in a code byte is corrected and any two are detected. Encoding and decoding
+// are one table lookup per nibble.
+extern const uint8_t fec_encode_table[16] PROGMEM;
+extern const uint8_t fec_decode_table[256] PROGMEM;  // Nibble, ORed with FEC_CORRECTED or FEC_FAILED
+
+// b as two code bytes, high nibble first
+static inline void fec_encode(uint8_t b, uint8_t* code){
+    code[0] = pgm_read_byte(&fec_encode_table[b >> 4]);
+    code[1] = pgm_read_byte(&fec_encode_table[b & 0x0F]);
+}
+
+// Byte of the two code bytes into *b, which may be code itself. Returns the flags of both.
+static inline uint8_t fec_decode(const uint8_t* code, uint8_t* b){
+    uint8_t hi = pgm_read_byte(&fec_decode_table[code[0]]);
+    uint8_t lo = pgm_read_byte(&fec_decode_table[code[1]]);
+    *b = (hi << 4) | (lo & 0x0F);
+    return (hi | lo) & (FEC_CORRECTED | FEC_FAILED);
+}
+
+#endif
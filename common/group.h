@@ -0,0 +1,16 @@
+#ifndef GROUP_H
+#define GROUP_H
+
+// Group addresses, one frame or packet for several Ill Mattos at once
+// Top bit set and bit i for Ill Matto i, so they only exist while ID_RANGE <= GROUP_MAX.
+// They go wherever an ID does (LLC DEST_address, NET DESTadd, TRAN and APP dest_ID).
+// 0xFF (INF) is never a group, a group never holds its sender.
+#define GROUP_FLAG 0x80
+#define GROUP_MAX 7             // Ill Mattos a group address can hold
+
+#define GROUP_OF(members) (GROUP_FLAG | (members))
+#define GROUP_MEMBERS(addr) ((addr) & ~GROUP_FLAG)
+#define IS_GROUP(addr) (((addr) & GROUP_FLAG) && ((addr) != 0xFF))
+#define IN_GROUP(addr, id) (IS_GROUP(addr) && (GROUP_MEMBERS(addr) & (1 << (id))))
+
+#endif
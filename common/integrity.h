@@ -0,0 +1,19 @@
+#ifndef INTEGRITY_H
+#define INTEGRITY_H
+
+// Integrity policy, which layers check the payload on top of the LLC CRC-16
+// Every frame is verified by the LLC CRC on every hop, so the checks above it only
+// find errors the CRC can not see: corruption inside a relay that forwards the packet.
+// Chosen per build (e.g. DEFS += -DINTEGRITY_POLICY=0), all nodes must use the same one.
+#define INTEGRITY_LINK 0        // LLC CRC only, NET and TRAN trust the frames handed up
+#define INTEGRITY_END_TO_END 1  // plus TRAN Fletcher-16 from source to destination
+#define INTEGRITY_EVERY_LAYER 2 // plus NET parity on every hop
+
+#ifndef INTEGRITY_POLICY
+#define INTEGRITY_POLICY INTEGRITY_END_TO_END   // flooding forwards over several hops
+#endif
+
+#define NET_CHECK (INTEGRITY_POLICY >= INTEGRITY_EVERY_LAYER)
+#define TRAN_CHECK (INTEGRITY_POLICY >= INTEGRITY_END_TO_END)
+
+#endif
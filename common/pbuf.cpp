@@ -0,0 +1,78 @@
+#include "pbuf.h"
+#include <string.h>
+#include <util/atomic.h>
+
+static pbuf pool[PBUF_POOL_SIZE];
+
+
+// Pool access is atomic, so buffers may be taken and freed from ISRs as well
+pbuf* pbuf_alloc(uint8_t headroom){
+    pbuf* pb = 0;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        for(uint8_t i = 0; i < PBUF_POOL_SIZE; i++){
+            if(!pool[i].ref){
+                pb = &pool[i];
+                pb->ref = 1;
+                break;
+            }
+        }
+    }
+    if(pb){
+        pb->head = headroom;
+        pb->len = 0;
+    }
+    return pb;
+}
+
+void pbuf_ref(pbuf* pb){
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        pb->ref++;
+    }
+}
+
+void pbuf_free(pbuf* pb){
+    if(!pb)
+        return;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        if(pb->ref)
+            pb->ref--;
+    }
+}
+
+pbuf* pbuf_copy(pbuf* pb){
+    pbuf* cp = pbuf_alloc(pb->head);
+    if(cp)
+        memcpy(pbuf_put(cp, pb->len), pbuf_data(pb), pb->len);
+    return cp;
+}
+
+uint8_t* pbuf_push(pbuf* pb, uint8_t n){
+    if(n > pb->head)
+        return 0;           // Not enough headroom reserved by the allocating layer
+    pb->head -= n;
+    pb->len += n;
+    return &pb->buffer[pb->head];
+}
+
+uint8_t* pbuf_pull(pbuf* pb, uint8_t n){
+    if(n > pb->len)
+        n = pb->len;
+    pb->head += n;
+    pb->len -= n;
+    return &pb->buffer[pb->head];
+}
+
+uint8_t* pbuf_put(pbuf* pb, uint8_t n){
+    uint8_t* tail = &pb->buffer[pb->head + pb->len];
+    if(pb->head + pb->len + n > PBUF_SIZE)
+        return 0;           // Not enough tailroom
+    pb->len += n;
+    return tail;
+}
+
+void pbuf_trim(pbuf* pb, uint8_t n){
+    if(n > pb->len)
+        n = pb->len;
+    pb->len -= n;
+}
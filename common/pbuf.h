@@ -0,0 +1,40 @@
+#ifndef PBUF_H
+#define PBUF_H
+
+#include <stdint.h>
+
+#define PBUF_SIZE 128       // Largest PDU carried by the stack (one full NET packet)
+#define PBUF_POOL_SIZE 8    // Number of packet buffers shared by all layers
+
+// Packet buffer shared by every layer of the stack
+// The PDU lives in buffer[head] .. buffer[head + len - 1]. Sending layers push their
+// header in front of it and put their trailer behind it, receiving layers pull/trim
+// them again, so no layer has to copy the payload into its own array.
+//
+// Ownership: whoever calls pbuf_alloc() calls pbuf_free(). A layer that is handed a
+// pbuf by the layer above or below only borrows it for the duration of the call and
+// pulls/trims anything it pushed/put before returning. A buffer that must outlive its
+// owner while it is being sent (e.g. a queued segment) takes an extra pbuf_ref().
+typedef struct pbuf{
+    uint8_t ref;                // References held, 0 = free in pool
+    uint8_t head;               // Offset of first byte of PDU
+    uint8_t len;                // Number of bytes in PDU
+    uint8_t buffer[PBUF_SIZE];
+}pbuf;
+
+pbuf* pbuf_alloc(uint8_t headroom);     // Take empty buffer from pool, 0 if pool exhausted
+void pbuf_ref(pbuf* pb);                // Take another reference
+void pbuf_free(pbuf* pb);               // Drop a reference, buffer returns to pool with the last one
+pbuf* pbuf_copy(pbuf* pb);              // New buffer with same headroom and PDU, 0 if pool exhausted
+
+uint8_t* pbuf_push(pbuf* pb, uint8_t n);  // Prepend n header bytes, returns new start of PDU
+uint8_t* pbuf_pull(pbuf* pb, uint8_t n);  // Strip n header bytes, returns new start of PDU
+uint8_t* pbuf_put(pbuf* pb, uint8_t n);   // Append n bytes, returns pointer to appended bytes
+void pbuf_trim(pbuf* pb, uint8_t n);      // Remove n trailer bytes
+
+// Start of PDU
+static inline uint8_t* pbuf_data(pbuf* pb){
+    return &pb->buffer[pb->head];
+}
+
+#endif
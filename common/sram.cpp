@@ -0,0 +1,86 @@
+#include "sram.h"
+#include "pbuf.h"
+#include "event.h"
+#include "timer.h"
+#include "stats.h"
+#include "../rfm12lib/uart.h"
+
+static uint16_t budget[SRAM_LAYERS];
+
+#ifdef __PLATFORM_AVR__
+extern uint8_t __heap_start;    // End of .bss, nothing is allocated from the heap
+
+// Runs from .init3 once the stack pointer is set up, before the statics are
+// initialised and main() is called. Naked, so it has no prologue and falls through to
+// the next init section: the loop is written in assembly on fixed registers, so it
+// never needs a stack frame whatever the optimiser does.
+void sram_paint(void) __attribute__((naked, used, section(".init3")));
+void sram_paint(void){
+    __asm__ __volatile__(
+        "ldi r30, lo8(__heap_start)\n\t"
+        "ldi r31, hi8(__heap_start)\n\t"
+        "ldi r24, %0\n\t"
+        "in r26, %1\n\t"
+        "in r27, %2\n"
+        "1:\n\t"
+        "cp r30, r26\n\t"
+        "cpc r31, r27\n\t"
+        "brsh 2f\n\t"
+        "st Z+, r24\n\t"
+        "rjmp 1b\n"
+        "2:\n\t"
+        :
+        : "M" (SRAM_PAINT), "I" (_SFR_IO_ADDR(SPL)), "I" (_SFR_IO_ADDR(SPH))
+        : "r24", "r26", "r27", "r30", "r31", "memory");
+}
+
+// The paint is read from the bottom up, the first byte changed is as deep as the
+// stack ever got
+uint16_t sram_free_min(void){
+    uint8_t* p = &__heap_start;
+    while(p <= (uint8_t*) RAMEND && *p == SRAM_PAINT)
+        p++;
+    return p - &__heap_start;
+}
+
+static uint16_t sram_static(void){
+    return (uint16_t) &__heap_start - RAMSTART;
+}
+#else
+uint16_t sram_free_min(void){
+    return 0;
+}
+
+static uint16_t sram_static(void){
+    return 0;
+}
+#endif
+
+void sram_init(void){
+    sram_budget(SRAM_COMMON, PBUF_POOL_SIZE * sizeof(pbuf)
+            + EVENT_QUEUE_SIZE * sizeof(event) + EV_TYPES * sizeof(event_handler)
+            + TIMER_WHEEL_SLOTS * sizeof(timer*)
+            + UART_TX_BUFFER_SIZE);
+#if STATS
+    sram_budget(SRAM_COMMON, sizeof(stats_counters));
+#endif
+}
+
+void sram_budget(uint8_t layer, uint16_t bytes){
+    if(layer < SRAM_LAYERS)
+        budget[layer] += bytes;
+}
+
+// put_val() per figure, so no printf is linked in for it
+void sram_report(void){
+    put_str("SRAM\n\r");
+    put_val("free=", sram_free_min());
+    put_val("static=", sram_static());
+    put_val("radio=", budget[SRAM_RADIO]);
+    put_val("mac=", budget[SRAM_MAC]);
+    put_val("llc=", budget[SRAM_LLC]);
+    put_val("net=", budget[SRAM_NET]);
+    put_val("tran=", budget[SRAM_TRAN]);
+    put_val("app=", budget[SRAM_APP]);
+    put_val("common=", budget[SRAM_COMMON]);
+}
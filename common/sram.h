@@ -0,0 +1,33 @@
+#ifndef SRAM_H
+#define SRAM_H
+
+#include <stdint.h>
+
+#define SRAM_PAINT 0xC5         // Written over the free SRAM at boot, a byte still holding it was never used
+#define SRAM_QUERY 'M'          // Byte received over the UART that makes the node send its SRAM report
+
+// Static buffers by layer, in bytes
+enum{
+    SRAM_RADIO,             // rfm12lib TX buffer and RX ring
+    SRAM_MAC,               // CSMA transmit queue
+    SRAM_LLC,               // Packet queue and reassembly state
+    SRAM_NET,               // Routing tables and flood cache
+    SRAM_TRAN,              // Connections and their receive buffers
+    SRAM_APP,               // Application or benchmark
+    SRAM_COMMON,            // pbuf pool, event queue, timer wheel, UART ring, statistics
+    SRAM_LAYERS
+};
+
+// SRAM budget of the ATmega644p (4 KB)
+// The gap between the statics and the stack is painted with SRAM_PAINT before main()
+// runs, the stack grows down into it and leaves the paint below its deepest point
+// alone. Every layer adds the size of its static buffers from its init function, so
+// queue depths can be weighed against the headroom measured under load.
+// Report: a line "SRAM", then "free=<min free bytes>", "static=<.data + .bss>" and the
+// bytes of every layer, one line each. On the host simulator free and static are 0.
+void sram_init(void);                                   // Adds the buffers of common/ and the UART
+void sram_budget(uint8_t layer, uint16_t bytes);        // Layer holds bytes more of static buffers
+uint16_t sram_free_min(void);                           // Bytes between statics and stack never used yet
+void sram_report(void);                                 // Queue the report on the UART
+
+#endif
@@ -0,0 +1,30 @@
+#include "stats.h"
+#include <string.h>
+#include <util/atomic.h>
+#include "crc16.h"
+#include "../2_2_LLC/LLC.h"
+#include "../rfm12lib/uart.h"
+
+stats_counters stats;
+
+
+void stats_dump(void){
+    stats_counters s;
+    uint8_t frame[3 + sizeof(stats_counters) + 2];
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        s = stats;
+        s.rx_overflows = rfm12_rx_overflow();   // Counted where they happen already
+        s.uart_dropped = uart_tx_dropped;
+    }
+    s.llc_resends = DLL_resends;
+
+    frame[0] = STATS_MAGIC;
+    frame[1] = STATS_VERSION;
+    frame[2] = sizeof(stats_counters);
+    memcpy(&frame[3], &s, sizeof(s));
+    uint16_t crc = crc16_block(CRC16_INIT, &frame[2], sizeof(stats_counters) + 1);
+    frame[sizeof(frame) - 2] = crc >> 8;
+    frame[sizeof(frame) - 1] = crc;
+    put_data(frame, sizeof(frame));
+}
@@ -0,0 +1,65 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+#ifndef STATS
+#define STATS 1                 // 0 = counters and histograms compile to nothing
+#endif
+
+#define STATS_BINS 12           // Latency bins, bin i counts 2^i .. 2^(i+1)-1 timer ticks, the last one all above
+#define STATS_QUERY 'S'         // Byte received over the UART that makes the node send its statistics
+#define STATS_MAGIC 0xA5        // First byte of a dump
+#define STATS_VERSION 3         // Second byte, changes with the layout of stats_counters
+
+// Counters of every layer and latency histograms in timer ticks (~1ms)
+// Each field is written from one context only (main loop or one ISR), so an event
+// costs one 16 bit increment. Counters wrap, the reader takes differences.
+typedef struct stats_counters{
+    uint16_t frames_tx;         // PHY: frames queued for the radio, ACKs included
+    uint16_t frames_rx;         // PHY: frames taken from the radio
+    uint16_t bytes_tx;          // PHY: bytes of the frames queued, without the radio header
+    uint16_t bytes_rx;          // PHY: bytes of the frames taken
+    uint16_t llc_resends;       // LLC: frames sent again after an ACK timeout
+    uint16_t llc_crc_errors;    // LLC: frames for this node with a bad CRC
+    uint16_t llc_fec_corrected; // LLC: FEC frames with bit errors corrected
+    uint16_t net_errors;        // NET: packets with a bad length or parity
+    uint16_t tran_errors;       // TRAN: segments with a bad length or checksum
+    uint16_t csma_backoffs;     // MAC: backoff slots waited before sensing the channel again
+    uint16_t rx_overflows;      // Radio ISR: frames dropped, every RX buffer full
+    uint16_t tran_nacks;        // TRAN: NACKs received
+    uint16_t tran_timeouts;     // TRAN: retransmit timer ran out
+    uint16_t uart_dropped;      // UART: messages dropped, transmit ring full
+    uint16_t ack_latency[STATS_BINS];   // LLC: frame queued to its ACK, frames sent once only
+    uint16_t segment_rtt[STATS_BINS];   // TRAN: segment sent to its answer, segments sent once only
+}stats_counters;
+
+// Dump sent over the UART, binary and little endian like the AVR:
+// STATS_MAGIC, STATS_VERSION, length, length bytes of stats_counters, CRC-16 over length
+// and the counters (common/crc16.h), MSB first.
+#if STATS
+extern stats_counters stats;
+
+static inline void stats_time(uint16_t* hist, uint16_t ticks){
+    uint8_t bin = 0;
+    while(ticks > 1 && bin < STATS_BINS - 1){
+        ticks >>= 1;
+        bin++;
+    }
+    hist[bin]++;
+}
+
+#define STATS_INC(field) (stats.field++)
+#define STATS_ADD(field, n) (stats.field += (n))
+#define STATS_TIME(hist, ticks) stats_time(stats.hist, ticks)
+
+void stats_dump(void);          // Queue the dump on the UART, dropped and counted if the ring is too full
+#else
+#define STATS_INC(field) ((void)0)
+#define STATS_ADD(field, n) ((void)0)
+#define STATS_TIME(hist, ticks) ((void)0)
+
+static inline void stats_dump(void){}
+#endif
+
+#endif
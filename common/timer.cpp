@@ -0,0 +1,127 @@
+#include "timer.h"
+#include <util/atomic.h>
+#include "event.h"
+
+#define TIMER_SLOT(tick) ((tick) & (TIMER_WHEEL_SLOTS - 1))
+
+static timer* wheel[TIMER_WHEEL_SLOTS];
+static volatile uint32_t slots_used;    // Bit per slot with a timer in it, read by the tick
+static volatile uint16_t now;           // Current tick
+static uint16_t done;                   // Last tick whose timers were run
+static volatile uint8_t due;            // A used slot came round, EV_TIMER not posted yet
+static volatile uint8_t posted;         // EV_TIMER waiting in the queue
+
+
+// Called with interrupts off
+static void unlink(timer* t){
+    uint8_t slot = TIMER_SLOT(t->expires);
+    timer** p = &wheel[slot];
+    while(*p && *p != t)
+        p = &(*p)->next;
+    if(*p)
+        *p = t->next;
+    if(!wheel[slot])
+        slots_used &= ~(1UL << slot);
+    t->active = 0;
+}
+
+static void timer_run(event* e){
+    uint16_t until;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        posted = 0;
+        due = 0;
+        until = now;
+    }
+    // Every tick up to now, the main loop may have been busy for several
+    while(done != until){
+        done++;
+        uint8_t slot = TIMER_SLOT(done);
+        if(!(slots_used & (1UL << slot)))
+            continue;
+        // Handlers may start timers in this slot again, the expired ones are taken
+        // off first so each runs once
+        timer* expired = 0;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+            timer** p = &wheel[slot];
+            while(*p){
+                timer* t = *p;
+                if(t->expires == done){
+                    *p = t->next;
+                    t->active = 0;
+                    t->next = expired;
+                    expired = t;
+                }
+                else
+                    p = &t->next;
+            }
+            if(!wheel[slot])
+                slots_used &= ~(1UL << slot);
+        }
+        while(expired){
+            timer* t = expired;
+            expired = t->next;
+            t->handler(t);
+        }
+    }
+}
+
+void timer_init(void){
+    event_subscribe(EV_TIMER, timer_run);
+}
+
+void timer_setup(timer* t, timer_handler handler, uint8_t arg){
+    t->next = 0;
+    t->active = 0;
+    t->handler = handler;
+    t->arg = arg;
+}
+
+void timer_start(timer* t, uint16_t ticks){
+    if(ticks == 0)
+        ticks = 1;
+    if(ticks > TIMER_MAX)
+        ticks = TIMER_MAX;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        if(t->active)
+            unlink(t);
+        t->expires = now + ticks;
+        uint8_t slot = TIMER_SLOT(t->expires);
+        t->next = wheel[slot];
+        wheel[slot] = t;
+        slots_used |= 1UL << slot;
+        t->active = 1;
+    }
+}
+
+void timer_stop(timer* t){
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        if(t->active)
+            unlink(t);
+    }
+}
+
+uint16_t timer_now(void){
+    uint16_t t;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        t = now;
+    }
+    return t;
+}
+
+uint16_t timer_left(timer* t){
+    uint16_t left = 0;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        if(t->active)
+            left = t->expires - now;
+    }
+    return left;
+}
+
+void timer_tick(void){
+    now++;
+    if(slots_used & (1UL << TIMER_SLOT(now)))
+        due = 1;
+    if(due && !posted && !event_post(EV_TIMER, 0, 0))
+        posted = 1;     // Tried again on the next tick if the queue was full
+}
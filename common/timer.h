@@ -0,0 +1,42 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+#define TIMER_TICK_US 1024      // One timer tick, the MAC tick on TIMER2
+#define TIMER_WHEEL_SLOTS 32    // Slots of the wheel, a power of 2
+#define TIMER_MAX 32767         // Longest delay in ticks (~33s)
+
+// Ticks in ms milliseconds, at least one
+#define TIMER_MS(ms) ((uint16_t)(((uint32_t)(ms) * 1000 + TIMER_TICK_US - 1) / TIMER_TICK_US))
+
+// Software timers of every layer, on one hashed timer wheel
+// Timers of the same slot share a list and only the slot of the current tick is
+// looked at, so the cost of a tick does not grow with the number of timers. The tick
+// only notes that a slot is due, the handlers run as an EV_TIMER event in the main
+// loop and may send, allocate buffers or start timers again. All calls are atomic
+// and may be made from ISRs as well.
+typedef struct timer timer;
+typedef void (*timer_handler)(timer* t);
+
+struct timer{
+    timer* next;            // In the list of its slot
+    uint16_t expires;       // Tick the handler runs at
+    uint8_t active;         // In the wheel
+    uint8_t arg;            // Free for the owner, e.g. the peer of a connection
+    timer_handler handler;
+};
+
+void timer_init(void);                                      // Subscribe to EV_TIMER
+void timer_setup(timer* t, timer_handler handler, uint8_t arg);
+void timer_start(timer* t, uint16_t ticks);                 // (Re)start, handler runs after ticks (1 .. TIMER_MAX)
+void timer_stop(timer* t);
+uint16_t timer_now(void);                                   // Ticks since start, wraps
+uint16_t timer_left(timer* t);                              // Ticks before the handler runs, 0 if stopped
+void timer_tick(void);                                      // From the tick ISR
+
+static inline uint8_t timer_active(timer* t){
+    return t->active;
+}
+
+#endif
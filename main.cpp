@@ -6,31 +6,37 @@
 #include "3_NET/NET.h"
 #include "4_TRAN/TRAN.h"
 #include "5_APP/APP.h"
+#include "common/pbuf.h"
+#include "common/timer.h"
+#include "common/stats.h"
+#include "common/sram.h"
 
 
 void setup();
 
+//Queries over the UART, one byte each
+static void poll_uart(void){
+	char ch;
+	if (!poll_ch(&ch))
+		return;
+	if (ch == STATS_QUERY)
+		stats_dump();
+	else if (ch == SRAM_QUERY)
+		sram_report();
+}
+
 int main() {
 	setup();
-			
-
-	uint8_t TRANseg[TRAN_SIZE];
-	// Test segment from TRAN 
-    int DESTadd = 2;                 // Destination Address
-    for(int i = 0; i < TRAN_SIZE; i++)
-        TRANseg[i] = 0;
-	
-	TIMSK2 |= _BV(OCIE2A); //Count system time
-	transmit_NET(TRANseg, DESTadd);
-	put_str("done\n\n\n\n\n\r");
+	LOG_INFO("ready\n\r"); //Benchmark traffic comes from the firmware in bench/ (make BENCH=1)
 	
 	while(1){
 		
 		//_delay_ms(300000);
-		receive_PHY();
+		poll_PHY(); //Post received frames
+		event_dispatch(); //Run one event to completion
+		poll_uart(); //Answer a statistics or SRAM query
 		
 	}
-	TIMSK2 &= ~_BV(OCIE2A);
 		//transmit_DLL(net_array, DEST_address);
 		//_delay_ms(300000); // delay for readability
 	
@@ -38,37 +44,18 @@ int main() {
 
 void setup() {
 	
-	ecCount0 = 0;
-	ecCount1 = 0;
-	ecCount2 = 0;
-	ecLimit0 = 0;
-	ecLimit1 = 0;
-	ecLimit2 = 0;
-	
 	init_uart0();
+	sram_init(); //SRAM was painted before main(), the layers add their buffers as they start
 	_delay_ms(100);
 	rfm12_init();
 	_delay_ms(100);
 	sei();
 	
-	//initialise timer CHANGED TO TIMER 2
-	TCCR1A |= 0x00; 
-	TCCR1B |= _BV(CS10) | _BV(CS12) | _BV(WGM12); //Pre-scaler and CTC mode
-	OCR1A = (uint16_t) (((F_CPU/PRESCALER)/1000)*30); //30ms timer delay
-	
-		// Timer 2 set-up
-	TCCR2A |= _BV(WGM21);                         // Set CTC mode
-	TCCR2B |= _BV(CS20) | _BV(CS21) | _BV(CS22);  // Pre-scaler to 1024
-	OCR2A = 117;                                  // ~10ms
-	
-	 // Initialise distance table
-    for(int j = 0; j < ID_RANGE; j++){
-        for(int i = 0; i < ID_RANGE; i++){
-            if((i == ID)&&(j == ID))
-                distanceTable[i][j] = 0;
-            else
-                distanceTable[i][j] = INF;
-        }
-    }
+	timer_init(); // Software timers of every layer
+	csma_init(); // Timer 2 MAC tick, also ticks the timers and counts system time for NET
+	init_DLL();
+	init_NET();
+	init_transport_layer();
+	init_app_layer();
 }
 
@@ -47,6 +47,11 @@
 #include "rfm12_core.h"
 #include "rfm12.h"
 
+//incremental crc of received data
+#if RFM12_RX_CRC16
+	#include "../common/crc16.h"
+#endif
+
 //for uart debugging
 #if RFM12_UART_DEBUG
 	#include "uart.h"
@@ -62,7 +67,7 @@ rf_tx_buffer_t rf_tx_buffer;
 //if receive mode is not disabled (default)
 #if !(RFM12_TRANSMIT_ONLY)
 	//! Buffers and status to receive packets.
-	rf_rx_buffer_t rf_rx_buffers[2];
+	rf_rx_buffer_t rf_rx_buffers[RFM12_RX_BUFFER_COUNT];
 #endif /* RFM12_TRANSMIT_ONLY */
 
 //! Global control and status.
@@ -132,6 +137,11 @@ ISR(RFM12_INT_VECT, ISR_NOBLOCK)
 	//if receive mode is not disabled (default)
 	#if !(RFM12_TRANSMIT_ONLY)
 		static uint8_t checksum; //static local variables produce smaller code size than globals
+		static uint8_t *rx_ptr;  //next byte of the receive buffer, saves indexing the ring on every byte
+		#if RFM12_RX_CRC16
+			static uint16_t rx_crc; //stored to the buffer once it is complete
+		#endif
+		uint8_t data;
 	#endif /* !(RFM12_TRANSMIT_ONLY) */
 
 	do {
@@ -142,7 +152,12 @@ ISR(RFM12_INT_VECT, ISR_NOBLOCK)
 
 		//first we read the first byte of the status register
 		//to get the interrupt flags
-		status = rfm12_read_int_flags_inline();
+		#if RFM12_FIFO_STATUS_READ
+			//while receiving, a byte waiting in the fifo comes with it
+			status = rfm12_read_int_flags_fifo_inline(ctrl.rfm12_state <= STATE_RX_ACTIVE, &data);
+		#else
+			status = rfm12_read_int_flags_inline();
+		#endif
 
 		//if we use at least one of the status bits, we need to check the status again
 		//for the case in which another interrupt condition occured while we were handeling
@@ -163,14 +178,14 @@ ISR(RFM12_INT_VECT, ISR_NOBLOCK)
 				case STATE_RX_IDLE: {
 					//if receive mode is not disabled (default)
 					#if !(RFM12_TRANSMIT_ONLY)
-						uint8_t data;
-
 						//init the bytecounter - remember, we will read the length byte, so this must be 1
 						ctrl.bytecount = 1;
 
 						//read the length byte,  and write it to the checksum
 						//remember, the first byte is the length byte
-						data = rfm12_read(RFM12_CMD_READ);
+						#if !(RFM12_FIFO_STATUS_READ)
+							data = rfm12_read(RFM12_CMD_READ);
+						#endif
 						checksum = data;
 
 						//add the packet overhead and store it into a working variable
@@ -182,6 +197,11 @@ ISR(RFM12_INT_VECT, ISR_NOBLOCK)
 							put_ch(data);
 						#endif
 
+						//a packet longer than the buffer is not received at all, a truncated one would look complete
+						if (data > RFM12_RX_BUFFER_SIZE) {
+							break;
+						}
+
 						//see whether our buffer is free
 						//FIXME: put this into global statekeeping struct, the free state can be set by the function which pulls the packet, i guess
 						if (rf_rx_buffers[ctrl.buffer_in_num].status == STATUS_FREE) {
@@ -192,12 +212,22 @@ ISR(RFM12_INT_VECT, ISR_NOBLOCK)
 							//this length field will be used by application reading the
 							//buffer.
 							rf_rx_buffers[ctrl.buffer_in_num].len = data;
+							rx_ptr = &rf_rx_buffers[ctrl.buffer_in_num].type;
+
+							#if RFM12_RX_CRC16
+								rx_crc = CRC16_INIT;
+							#endif
+
+							#if RFM12_RX_RSSI
+								rf_rx_buffers[ctrl.buffer_in_num].rssi = status & (RFM12_STATUS_RSSI >> 8);
+							#endif
 
 							//end the interrupt without resetting the fifo
 							goto no_fifo_reset;
 						}
 
 						/* if we're here, the buffer is full, so we ignore this transmission by resetting the fifo (at the end of the function)  */
+						ctrl.rx_overflow++;
 					#endif /* !(RFM12_TRANSMIT_ONLY) */
 
 					} break;
@@ -205,12 +235,15 @@ ISR(RFM12_INT_VECT, ISR_NOBLOCK)
 				case STATE_RX_ACTIVE: {
 					//if receive mode is not disabled (default)
 					#if !(RFM12_TRANSMIT_ONLY)
-						uint8_t data;
+						uint8_t bytecount = ctrl.bytecount;
+
 						//read a byte
-						data = rfm12_read(RFM12_CMD_READ);
+						#if !(RFM12_FIFO_STATUS_READ)
+							data = rfm12_read(RFM12_CMD_READ);
+						#endif
 
 						//check if transmission is complete
-						if (ctrl.bytecount < ctrl.num_bytes) {
+						if (bytecount < ctrl.num_bytes) {
 							//debug
 							#if RFM12_UART_DEBUG >= 2
 								put_ch('R');
@@ -221,21 +254,26 @@ ISR(RFM12_INT_VECT, ISR_NOBLOCK)
 							//note: only the header will be effectively checked
 							checksum ^= data;
 
-							//put next byte into buffer, if there is enough space
-							if (ctrl.bytecount < (RFM12_RX_BUFFER_SIZE + 3)) {
-								//hackhack: begin writing to struct at offsetof len
-								(& rf_rx_buffers[ctrl.buffer_in_num].len)[ctrl.bytecount] = data;
-							}
+							//put next byte into buffer, type and checksum first
+							//there is enough space, the length byte was checked against the buffer
+							*rx_ptr++ = data;
+
+							//run the crc over the data bytes, behind type and checksum
+							#if RFM12_RX_CRC16
+								if (bytecount >= 3) {
+									rx_crc = crc16_update(rx_crc, data);
+								}
+							#endif
                                                         #ifndef DISABLE_CHECKSUMM
 							//check header against checksum
-							if (ctrl.bytecount == 2 && checksum != 0xff) {
+							if (bytecount == 2 && checksum != 0xff) {
 								//if the checksum does not match, reset the fifo
 								break;
 							}
                                                         #endif
 
 							//increment bytecount
-							ctrl.bytecount++;
+							ctrl.bytecount = bytecount + 1;
 
 							//end the interrupt without resetting the fifo
 							goto no_fifo_reset;
@@ -249,6 +287,10 @@ ISR(RFM12_INT_VECT, ISR_NOBLOCK)
 							put_ch('D');
 						#endif
 
+						#if RFM12_RX_CRC16
+							rf_rx_buffers[ctrl.buffer_in_num].crc = rx_crc;
+						#endif
+
 						//indicate that the buffer is ready to be used
 						rf_rx_buffers[ctrl.buffer_in_num].status = STATUS_COMPLETE;
 					
@@ -270,8 +312,8 @@ ISR(RFM12_INT_VECT, ISR_NOBLOCK)
 						puts("Press D go back to main menu");*/
 					
 
-						//switch to other buffer
-						ctrl.buffer_in_num ^= 1;
+						//switch to next buffer of the ring
+						ctrl.buffer_in_num = RFM12_RX_NEXT(ctrl.buffer_in_num);
 
 					#endif /* !(RFM12_TRANSMIT_ONLY) */
 					} break;
@@ -581,7 +623,7 @@ rfm12_start_tx(uint8_t type, uint8_t length) {
 #if !(RFM12_TRANSMIT_ONLY)
 	//! Function to clear buffer complete/occupied status.
 	/** This function will set the current receive buffer status to free and switch
-	* to the other buffer, which can then be read using rfm12_rx_buffer().
+	* to the next buffer of the ring, which can then be read using rfm12_rx_buffer().
 	*
 	* \see rfm12_rx_status(), rfm12_rx_len(), rfm12_rx_type(), rfm12_rx_buffer() and rf_rx_buffers
 	*/
@@ -590,13 +632,33 @@ rfm12_start_tx(uint8_t type, uint8_t length) {
 			//mark the current buffer as empty
 			rf_rx_buffers[ctrl.buffer_out_num].status = STATUS_FREE;
 
-			//switch to the other buffer
-			ctrl.buffer_out_num ^= 1;
+			//switch to the next buffer
+			ctrl.buffer_out_num = RFM12_RX_NEXT(ctrl.buffer_out_num);
 
 	}
 #endif /* !(RFM12_TRANSMIT_ONLY) */
 
 
+#if RFM12_LIVECTRL
+	//! Set the data rate, a DATARATE_VALUE (RFM12_DATARATE_CALC_HIGH() or _LOW()).
+	/** Sender and receiver must use the same one, a frame coming in while it changes is lost.
+	*/
+	void rfm12_set_rate(uint8_t datarate) {
+		RFM12_INT_OFF();
+		rfm12_data(RFM12_CMD_DATARATE | datarate);
+		RFM12_INT_ON();
+	}
+
+	//! Set the TX power, RFM12_TXCONF_POWER_0 (full) .. RFM12_TXCONF_POWER_21.
+	void rfm12_set_power(uint8_t power) {
+		ctrl.txconf_shadow = (ctrl.txconf_shadow & ~RFM12_TXCONF_POWER_MASK) | (power & RFM12_TXCONF_POWER_MASK);
+		RFM12_INT_OFF();
+		rfm12_data(ctrl.txconf_shadow);
+		RFM12_INT_ON();
+	}
+#endif
+
+
 //enable internal data register and fifo
 //setup selected band
 #define RFM12_CMD_CFG_DEFAULT   (RFM12_CMD_CFG | RFM12_CFG_EL | RFM12_CFG_EF | RFM12_BASEBAND | RFM12_XTAL_LOAD)
@@ -40,13 +40,18 @@
 #ifndef _RFM12_H
 #define _RFM12_H
 
-#ifdef __cplusplus
+//the host simulator compiles one copy of the library per virtual node into
+//its own namespace, so it must keep C++ linkage
+#if defined(__cplusplus) && !defined(__PLATFORM_SIM__)
 extern "C" {
 #endif
 
 #ifdef __PLATFORM_LINUX__
 #include <stdint.h>
 #endif
+#ifdef __PLATFORM_SIM__
+#include "../sim/sim.h"
+#endif
 #include <inttypes.h>
 
 #include "rfm12_core.h"
@@ -111,6 +116,12 @@ uint8_t rfm12_tx(uint8_t len, uint8_t type, uint8_t *data);
 void rfm12_poll(void);
 #endif
 
+//live control of the data rate and TX power, only while neither sending nor receiving
+#if RFM12_LIVECTRL
+void rfm12_set_rate(uint8_t datarate);
+void rfm12_set_power(uint8_t power);
+#endif
+
 
 /************************
  * private control structs
@@ -153,6 +164,16 @@ typedef struct {
 		/** \see \ref rxtx_states "States for rx and tx buffers" */
 		volatile uint8_t status;
 
+		#if RFM12_RX_CRC16
+			//! CRC-16 (common/crc16.h) over the received data bytes, updated byte by byte in the ISR
+			uint16_t crc;
+		#endif
+
+		#if RFM12_RX_RSSI
+			//! RSSI bit of the status register while the length byte came in, 1 = signal above RFM12_RSSI_THRESHOLD
+			uint8_t rssi;
+		#endif
+
 		//! Length byte - number of bytes in buffer.
 		uint8_t len;
 
@@ -198,6 +219,9 @@ typedef struct {
 
 		//! the number of the currently used out receive buffer.
 		uint8_t buffer_out_num;
+
+		//! Packets dropped because every receive buffer was full.
+		volatile uint16_t rx_overflow;
 	#endif /* !(RFM12_TRANSMIT_ONLY) */
 
 	#if RFM12_PWRMGT_SHADOW
@@ -225,7 +249,7 @@ extern rf_tx_buffer_t rf_tx_buffer;
 //if receive mode is not disabled (default)
 #if !(RFM12_TRANSMIT_ONLY)
 	//buffers for storing incoming transmissions
-	extern rf_rx_buffer_t rf_rx_buffers[2];
+	extern rf_rx_buffer_t rf_rx_buffers[RFM12_RX_BUFFER_COUNT];
 #endif /* !(RFM12_TRANSMIT_ONLY) */
 
 //the control struct
@@ -243,6 +267,9 @@ extern rfm12_control_t ctrl;
 	* \see \ref rxtx_states "rx buffer states", rfm12_rx_len(), rfm12_rx_type(), rfm12_rx_buffer(), rfm12_rx_clear() and rf_rx_buffer_t
 	*/
 	static inline uint8_t rfm12_rx_status(void) {
+		#ifdef __PLATFORM_SIM__
+			sim_idle(); //every polling loop ends up here, let the other nodes run
+		#endif
 		return rf_rx_buffers[ctrl.buffer_out_num].status;
 	}
 
@@ -269,6 +296,50 @@ extern rfm12_control_t ctrl;
 	static inline uint8_t *rfm12_rx_buffer(void) {
 		return (uint8_t*) rf_rx_buffers[ctrl.buffer_out_num].buffer;
 	}
+
+	//! Inline function to look at a received buffer behind the current one.
+	/** Buffers stay in place until released with rfm12_rx_clear(), so nothing is copied.
+	* \param n 0 for the current buffer, 1 for the one received after it, ...
+	* \returns A pointer to the buffer struct, or 0 if fewer than n+1 packets are waiting
+	* \see rfm12_rx_buffer(), rfm12_rx_clear() and rf_rx_buffer_t
+	*/
+	static inline rf_rx_buffer_t *rfm12_rx_peek(uint8_t n) {
+		uint8_t num = ctrl.buffer_out_num;
+		if (n >= RFM12_RX_BUFFER_COUNT)
+			return 0;
+		while (n--)
+			num = RFM12_RX_NEXT(num);
+		if (rf_rx_buffers[num].status != STATUS_COMPLETE)
+			return 0;
+		return &rf_rx_buffers[num];
+	}
+
+	//! Inline function to return the number of packets dropped because the receive ring was full.
+	/** \see rfm12_rx_peek() and RFM12_RX_BUFFER_COUNT
+	*/
+	static inline uint16_t rfm12_rx_overflow(void) {
+		return ctrl.rx_overflow;
+	}
+
+	#if RFM12_RX_CRC16
+	//! Inline function to return the CRC-16 over the current rx buffer contents.
+	/** \returns The CRC the ISR calculated over all rfm12_rx_len() data bytes, starting from CRC16_INIT
+	* \see rfm12_rx_status(), rfm12_rx_len(), rfm12_rx_buffer() and rf_rx_buffer_t
+	*/
+	static inline uint16_t rfm12_rx_crc(void) {
+		return rf_rx_buffers[ctrl.buffer_out_num].crc;
+	}
+	#endif
+
+	#if RFM12_RX_RSSI
+	//! Inline function to return whether the signal of the current rx buffer was above the RSSI threshold.
+	/** \returns 1 if the RSSI bit was set when the frame started, else 0
+	* \see rfm12_rx_status(), rfm12_rx_buffer() and rf_rx_buffer_t
+	*/
+	static inline uint8_t rfm12_rx_rssi(void) {
+		return rf_rx_buffers[ctrl.buffer_out_num].rssi;
+	}
+	#endif
 #endif /* !(RFM12_TRANSMIT_ONLY) */
 
 
@@ -280,7 +351,7 @@ extern rfm12_control_t ctrl;
 //#include "include/rfm12_livectrl.h"
 
 
-#ifdef __cplusplus
+#if defined(__cplusplus) && !defined(__PLATFORM_SIM__)
 }
 #endif
 
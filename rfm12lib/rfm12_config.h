@@ -98,17 +98,50 @@
 //11.5pF seems to be o.k. for RFM12, and 10.5pF for RFM12BP, but this may vary.
 #define RFM12_XTAL_LOAD       RFM12_XTAL_11_5PF
 
+//LINK ADAPTATION, 1 = the LLC moves the frames of a packet to a peer after the first one to a
+//faster rate and turns the TX power down while the link stays clean (2_2_LLC/LLC.h). Every node
+//listens at DATARATE_VALUE, the network rate, so it is lowered to reach further. Every node the same.
+#ifndef RFM12_LINK_ADAPT
+#define RFM12_LINK_ADAPT      0
+#endif
+
 //use this for datarates >= 2700 Baud
+#if RFM12_LINK_ADAPT
+#define DATARATE_VALUE        RFM12_DATARATE_CALC_HIGH(38400.0)
+#else
 #define DATARATE_VALUE        RFM12_DATARATE_CALC_HIGH(115200.0)
+#endif
 
 //use this for 340 Baud < datarate < 2700 Baud
 //#define DATARATE_VALUE      RFM12_DATARATE_CALC_LOW(1200.0)
 
+//rate levels of link adaptation, the network rate first, at most 4 (the frame header holds 2 bits)
+#define RFM12_LINK_RATES      {DATARATE_VALUE, RFM12_DATARATE_CALC_HIGH(57600.0), RFM12_DATARATE_CALC_HIGH(86200.0), RFM12_DATARATE_CALC_HIGH(115200.0)}
+
+//LONG PACKETS, 0 = short frames, the LLC splits a NET packet into up to 7 of them
+//1 = a whole NET packet goes out in one transmission, the ISR streams it through the
+//FIFO byte by byte either way. Costs about 1KB of RAM for the TX, RX and MAC buffers.
+#ifndef RFM12_LONG_PACKETS
+#define RFM12_LONG_PACKETS    0
+#endif
+
+#if RFM12_LONG_PACKETS
+//TX BUFFER SIZE, a 128 byte NET packet and the 9 bytes of LLC framing
+#define RFM12_TX_BUFFER_SIZE  140
+
+//RX BUFFER SIZE (there are going to be RFM12_RX_BUFFER_COUNT Buffers of this size)
+#define RFM12_RX_BUFFER_SIZE  140
+#else
 //TX BUFFER SIZE
 #define RFM12_TX_BUFFER_SIZE  30
 
-//RX BUFFER SIZE (there are going to be 2 Buffers of this size for double_buffering)
+//RX BUFFER SIZE (there are going to be RFM12_RX_BUFFER_COUNT Buffers of this size)
 #define RFM12_RX_BUFFER_SIZE  30
+#endif
+
+//RX BUFFER COUNT, depth of the receive ring, a power of 2
+//a burst of frames is kept while the application is busy with the first one
+#define RFM12_RX_BUFFER_COUNT 4
 
 
 /************************
@@ -155,6 +188,9 @@
 #define RFM12_LOW_POWER 0
 #define RFM12_USE_CLOCK_OUTPUT 0
 #define RFM12_LOW_BATT_DETECTOR 0
+#define RFM12_RX_CRC16 1 //ISR runs the CRC-16 of common/crc16.h over received data, see rfm12_rx_crc()
+#define RFM12_RX_RSSI 1 //ISR keeps the RSSI bit of the status read with the length byte, see rfm12_rx_rssi()
+#define RFM12_FIFO_STATUS_READ 1 //ISR takes each received byte in its status read, one SPI transaction per byte (hardware SPI only)
 
 
 #define RFM12_LBD_VOLTAGE             RFM12_LBD_VOLTAGE_3V0
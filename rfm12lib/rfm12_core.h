@@ -21,6 +21,10 @@
 #ifndef _RFM12_CORE_H
 #define _RFM12_CORE_H
 
+//make sure the library configuration is always seen before the defaults below
+#include "rfm12_config.h"
+#include "rfm12_hw.h"
+
 /************************
 * VARIOUS RFM RELATED DEFINES FOR INTERNAL USE	
 *(defines which shall be visible to the user are located in rfm12.h)
@@ -90,6 +94,28 @@
 	#define RFM12_LOW_BATT_DETECTOR 0
 #endif
 
+//if the rx buffer count is not defined, we use double buffering
+#ifndef RFM12_RX_BUFFER_COUNT
+	#define RFM12_RX_BUFFER_COUNT 2
+#endif
+
+#if (RFM12_RX_BUFFER_COUNT < 2) || (RFM12_RX_BUFFER_COUNT & (RFM12_RX_BUFFER_COUNT - 1))
+	#error "RFM12_RX_BUFFER_COUNT must be a power of 2 and at least 2"
+#endif
+
+//the ISR counts the bytes of a packet in 8 bits, header, sync and dummy byte included
+#if (RFM12_TX_BUFFER_SIZE > 255 - 6) || (RFM12_RX_BUFFER_SIZE > 255 - PACKET_OVERHEAD)
+	#error "RFM12_TX_BUFFER_SIZE and RFM12_RX_BUFFER_SIZE must leave room for the header in 255 bytes"
+#endif
+
+//next buffer of the receive ring
+#define RFM12_RX_NEXT(num) (((num) + 1) & (RFM12_RX_BUFFER_COUNT - 1))
+
+//if rx crc is not defined, we won't use this feature
+#ifndef RFM12_RX_CRC16
+	#define RFM12_RX_CRC16 0
+#endif
+
 #ifndef RFM12_USE_CLOCK_OUTPUT
 	#define RFM12_USE_CLOCK_OUTPUT 0
 #endif
@@ -154,6 +180,16 @@
 	#define RFM12_RECEIVE_ASK 0
 #endif
 
+//if the combined status and fifo read is not defined, the ISR uses the Receiver FIFO Read Command
+#ifndef RFM12_FIFO_STATUS_READ
+	#define RFM12_FIFO_STATUS_READ 0
+#endif
+//it takes the hardware spi and a receiver
+#if RFM12_SPI_SOFTWARE || RFM12_TRANSMIT_ONLY
+	#undef RFM12_FIFO_STATUS_READ
+	#define RFM12_FIFO_STATUS_READ 0
+#endif
+
 //if software spi is not defined, we won't use this feature
 #ifndef RFM12_SPI_SOFTWARE
 	#define RFM12_SPI_SOFTWARE 0
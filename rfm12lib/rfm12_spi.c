@@ -122,6 +122,46 @@ static uint8_t rfm12_read_int_flags_inline(void) {
 	#endif
 }
 
+#if RFM12_FIFO_STATUS_READ
+/* @description reads the upper 8 bits of the status register like
+ * rfm12_read_int_flags_inline(). With fifo set and the FIFO interrupt
+ * pending the transaction goes on: the rfm12 shifts out the lower status
+ * byte and then the FIFO byte, which is stored to *data. One chip select
+ * for a received byte instead of this and the Receiver FIFO Read Command.
+ */
+static inline uint8_t rfm12_read_int_flags_fifo_inline(uint8_t fifo, uint8_t *data) {
+	uint8_t status;
+	SS_ASSERT();
+	SPDR = 0;
+	while (!(SPSR & (1<<SPIF)));
+	status = SPDR;
+	if (fifo && (status & (RFM12_STATUS_FFIT>>8))) {
+		SPDR = 0;
+		while (!(SPSR & (1<<SPIF)));
+		SPDR = 0;
+		while (!(SPSR & (1<<SPIF)));
+		*data = SPDR;
+	}
+	SS_RELEASE();
+	return status;
+}
+#endif
+
+//fastest SPI clock within fref/4 = 2.5 MHz (10 MHz crystal), the limit of the rfm12 during FIFO access
+#if !defined(F_CPU) || F_CPU > 20000000UL
+	#define RFM12_SPI_SPR (1<<SPR0)  //clk/16
+	#define RFM12_SPI_2X 0
+#elif F_CPU > 10000000UL
+	#define RFM12_SPI_SPR (1<<SPR0)  //clk/8, 1.5 MHz at 12 MHz
+	#define RFM12_SPI_2X (1<<SPI2X)
+#elif F_CPU > 5000000UL
+	#define RFM12_SPI_SPR 0          //clk/4
+	#define RFM12_SPI_2X 0
+#else
+	#define RFM12_SPI_SPR 0          //clk/2
+	#define RFM12_SPI_2X (1<<SPI2X)
+#endif
+
 static void spi_init(void) {
 	DDR_MOSI |= (_BV(BIT_MOSI));
 	DDR_SCK  |= (_BV(BIT_SCK));
@@ -133,8 +173,16 @@ static void spi_init(void) {
 	DDR_MISO &= ~(_BV(BIT_MISO));
 
 	#if !(RFM12_SPI_SOFTWARE)
-		SPCR = (1<<SPE) | (1<<MSTR) | (1<<SPR0); //SPI Master, clk/16
+		SPCR = (1<<SPE) | (1<<MSTR) | RFM12_SPI_SPR; //SPI Master
+		SPSR = RFM12_SPI_2X;
 	#endif
 }
 
 #endif
+
+#ifdef __PLATFORM_SIM__
+//the simulated radio (sim/rfm12_sim.cpp) decodes the commands instead of an SPI bus
+void rfm12_data(uint16_t d);
+uint16_t rfm12_read(uint16_t c);
+#endif
+
@@ -1,5 +1,16 @@
 #include "uart.h"
+#include <util/atomic.h>
 
+//Output is queued and sent by the UDRE interrupt, so logging never waits for the line.
+//A message that does not fit is dropped as a whole and counted.
+//Room is reserved with interrupts off, the bytes are copied with them on. An interrupt
+//may log in between, its bytes only go out with those of the message it interrupted.
+static char tx_ring[UART_TX_BUFFER_SIZE];
+static volatile uint8_t tx_head; //end of the bytes ready to send
+static volatile uint8_t tx_tail; //next byte to send
+static volatile uint8_t tx_reserved; //end of the bytes reserved, tx_head once no message is being copied
+static volatile uint8_t tx_writers; //messages being copied
+volatile uint16_t uart_tx_dropped;
 
 void init_uart0 (void)
 {
@@ -9,6 +20,10 @@ void init_uart0 (void)
 	UBRR0L = (F_CPU/(baud_rate*16L)-1);
 	UCSR0B = _BV(RXEN0) | _BV(TXEN0);
 	UCSR0C = _BV(UCSZ00) | _BV(UCSZ01);
+	tx_head = 0;
+	tx_tail = 0;
+	tx_reserved = 0;
+	tx_writers = 0;
 }
 
 char get_ch (void)
@@ -16,14 +31,109 @@ char get_ch (void)
 	while (!( UCSR0A & _BV(RXC0)));
 	return UDR0 ;
 }
+
+//1 and the byte in ch if one was received, returns at once
+uint8_t poll_ch (char *ch)
+{
+	if (!(UCSR0A & _BV(RXC0)))
+		return 0;
+	*ch = UDR0;
+	return 1;
+}
+
+//queue len bytes, nothing is queued unless all of them fit
+static void put_bytes (const char *data, uint8_t len)
+{
+	uint8_t start;
+	uint8_t fits;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		start = tx_reserved;
+		fits = len <= UART_TX_BUFFER_SIZE - 1 - (uint8_t)(start - tx_tail);
+		if (fits){
+			tx_reserved += len;
+			tx_writers++;
+		}
+		else
+			uart_tx_dropped++;
+	}
+	if (!fits)
+		return;
+	for (uint8_t i = 0; i < len; i++)
+		tx_ring[(uint8_t)(start + i) & (UART_TX_BUFFER_SIZE - 1)] = data[i];
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if (--tx_writers == 0){
+			tx_head = tx_reserved;
+			UCSR0B |= _BV(UDRIE0); //start draining
+		}
+	}
+}
+
 void put_ch ( char ch)
 {
-	while (!(UCSR0A & _BV(UDRE0)));
-	UDR0 = ch;
+	put_bytes(&ch, 1);
+}
+
+//binary data, sent as one message like a string
+void put_data (const uint8_t *data, uint8_t len)
+{
+	put_bytes((const char *) data, len);
+}
+
+void put_str (const char *str)
+{
+	size_t len = strlen(str);
+	put_bytes(str, len < UART_TX_BUFFER_SIZE ? len : UART_TX_BUFFER_SIZE - 1);
+}
+
+//label, decimal value and line end as one message, a long label is cut
+void put_val (const char *label, int value)
+{
+	char digits[sizeof(int) * 3];
+	char text[40];
+	uint8_t n = 0;
+	uint8_t d = 0;
+	unsigned int u = (value < 0) ? -(unsigned int) value : (unsigned int) value;
+
+	do {
+		digits[d++] = '0' + u % 10;
+		u /= 10;
+	} while (u);
+	while (*label && n < sizeof(text) - sizeof(digits) - 3)
+		text[n++] = *label++;
+	if (value < 0)
+		text[n++] = '-';
+	while (d)
+		text[n++] = digits[--d];
+	text[n++] = '\n';
+	text[n++] = '\r';
+	put_bytes(text, n);
+}
+
+//hex dump, queued in chunks so a long buffer does not need the whole ring at once
+void put_hex (const uint8_t *data, uint8_t len)
+{
+	static const char digits[] = "0123456789ABCDEF";
+	char text[33];
+	uint8_t n = 0;
+
+	for (uint8_t i = 0; i < len; i++){
+		text[n++] = digits[data[i] >> 4];
+		text[n++] = digits[data[i] & 0x0f];
+		if (n == sizeof(text) - 1 || i == len - 1){
+			put_bytes(text, n);
+			n = 0;
+		}
+	}
+	put_bytes("\r\n", 2);
 }
 
-void put_str (char *str)
+ISR(USART0_UDRE_vect)
 {
-	int i;
-	for (i=0; str[i]; i++) put_ch(str[i]);
+	if (tx_head != tx_tail){
+		UDR0 = tx_ring[tx_tail & (UART_TX_BUFFER_SIZE - 1)];
+		tx_tail++;
+	}
+	else{
+		UCSR0B &= ~_BV(UDRIE0); //ring empty
+	}
 }
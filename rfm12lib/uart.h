@@ -1,3 +1,6 @@
+#ifndef UART_H
+#define UART_H
+
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
@@ -6,9 +9,52 @@
 
 #define F_CPU 12000000
 
+//transmit ring, drained by the UDRE interrupt; must be a power of two
+#define UART_TX_BUFFER_SIZE 128
+
+//log levels, messages above LOG_LEVEL compile to nothing
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_DEBUG 3
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(str) put_str(str)
+#else
+#define LOG_ERROR(str) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(str) put_str(str)
+#else
+#define LOG_INFO(str) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(str) put_str(str)
+#define LOG_DEBUG_VAL(label, value) put_val(label, value)
+#define LOG_DEBUG_HEX(data, len) put_hex(data, len)
+#else
+#define LOG_DEBUG(str) ((void)0)
+#define LOG_DEBUG_VAL(label, value) ((void)0)
+#define LOG_DEBUG_HEX(data, len) ((void)0)
+#endif
+
 //uart
 void init_uart0 (void);
 char get_ch (void);
+uint8_t poll_ch (char *ch);
 void put_ch (char ch);
-void put_str (char *str);
+void put_str (const char *str);
+void put_val (const char *label, int value);
+void put_hex (const uint8_t *data, uint8_t len);
+void put_data (const uint8_t *data, uint8_t len);
+
+//messages dropped because the transmit ring was full
+extern volatile uint16_t uart_tx_dropped;
 
+#endif
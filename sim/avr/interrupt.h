@@ -0,0 +1,15 @@
+// Host shim for <avr/interrupt.h>
+// ISRs become plain functions that the simulator calls from the node's interrupt
+// thread. cli()/sei() take and release the node's interrupt lock, so the main
+// context and ISRs of one node never run an atomic section at the same time.
+#ifndef SIM_AVR_INTERRUPT_H
+#define SIM_AVR_INTERRUPT_H
+
+#include "../sim.h"
+
+#define ISR(vector, ...) void vector(void)
+
+#define cli() sim_irq_disable()
+#define sei() sim_irq_enable()
+
+#endif
@@ -0,0 +1,62 @@
+// Host shim for <avr/io.h>
+// Only bit positions live here. The registers themselves belong to one virtual node
+// each and are declared by sim/node.cpp inside that node's namespace.
+#ifndef SIM_AVR_IO_H
+#define SIM_AVR_IO_H
+
+#include <stdint.h>
+
+#define _BV(bit) (1 << (bit))
+
+// Timer/Counter 0, 1, 2
+#define CS00 0
+#define CS01 1
+#define CS02 2
+#define WGM00 0
+#define WGM01 1
+#define WGM02 3
+#define COM0A0 6
+#define COM0A1 7
+#define OCIE0A 1
+#define OCF0A 1
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define WGM12 3
+#define OCIE1A 1
+#define OCF1A 1
+#define CS20 0
+#define CS21 1
+#define CS22 2
+#define WGM21 1
+#define OCIE2A 1
+#define OCF2A 1
+
+// USART0
+#define RXC0 7
+#define UDRE0 5
+#define RXEN0 4
+#define TXEN0 3
+#define UDRIE0 5
+#define UCSZ00 1
+#define UCSZ01 2
+
+// External interrupts
+#define INT0 0
+#define INT2 2
+#define INTF2 2
+#define ISC21 5
+
+// Ports
+#define PORTC0 0
+#define PORTC1 1
+
+// SPI
+#define SPE 6
+#define MSTR 4
+#define SPR0 0
+#define SPR1 1
+#define SPI2X 0
+#define SPIF 7
+
+#endif
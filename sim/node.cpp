@@ -0,0 +1,194 @@
+// One virtual node of the host simulator, built once per node with -DID=<n>
+// The stack (1_PHY .. 5_APP) is included into a namespace of its own, so every node
+// has private copies of the layer state, of the AVR registers it touches and of the
+// radio. System headers and the AVR shims are included first, outside the namespace.
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/delay.h>
+#include <util/atomic.h>
+#include "sim.h"
+
+#ifndef ID
+#error "build one object per node with -DID=<n>"
+#endif
+
+#define SIM_NODE_NS_(id) node##id
+#define SIM_NODE_NS(id) SIM_NODE_NS_(id)
+
+namespace SIM_NODE_NS(ID) {
+
+// Timers
+volatile uint8_t TCCR2A, TCCR2B, OCR2A, TCNT2, TIMSK2, TIFR2;
+
+// External interrupts and ports
+volatile uint8_t EIMSK, EICRA, EIFR;
+volatile uint8_t PORTB, DDRB, PINB, PORTC, DDRC, PORTD, DDRD, PIND;
+
+// USART0, a byte written to UDR0 is printed and keeps the transmitter busy for
+// 10 bit times at the programmed baud rate, like the real 9600 baud link. The
+// data register empty interrupt fires once it has left.
+volatile uint8_t UBRR0H, UBRR0L, UCSR0B, UCSR0C;
+
+struct sim_udr{
+	uint64_t busy_until;
+	sim_udr& operator=(uint8_t c){
+		char s[2] = {(char)c, 0};
+		sim_log(ID, s);
+		busy_until = sim_now_us() + 10ULL * 16 * (((UBRR0H << 8) | UBRR0L) + 1) * 1000000 / F_CPU;
+		return *this;
+	}
+	operator uint8_t() const { return 0; }
+};
+sim_udr UDR0;
+
+struct sim_ucsra{
+	operator uint8_t() const {
+		if (sim_now_us() >= UDR0.busy_until)
+			return _BV(UDRE0);
+		sim_idle(); //status is only read in polling loops
+		return 0;
+	}
+};
+sim_ucsra UCSR0A;
+
+#include "../common/pbuf.cpp"
+#include "../common/crc16.cpp"
+#include "../common/fec.cpp"
+#include "../common/event.cpp"
+#include "../common/timer.cpp"
+#include "../common/sram.cpp"
+#include "../rfm12lib/uart.cpp"
+#include "../1_PHY/PHY.cpp"
+#include "../2_1_MAC/csma.cpp"
+#include "../2_2_LLC/LLC.cpp"
+#include "../3_NET/NET.cpp"
+#include "../4_TRAN/TRAN.cpp"
+#if SIM_BENCH
+#define BENCH_AUTORUN (ID == 0) //Node 0 runs the scenario, the others answer
+#include "../bench/bench.cpp"
+#else
+#include "../5_APP/APP.cpp"
+#endif
+#include "../common/stats.cpp"
+#include "rfm12_sim.cpp"
+
+// application/ drives LEDs and buttons, the simulator stands in for it
+static int switch_counter;
+int switch_count_val(void){ return switch_counter; }
+void increment_switch_counter(void){ switch_counter++; }
+void reset_switch_counter(void){ switch_counter = 0; }
+
+void event_received(uint8_t button, uint8_t button_count){
+	sim_event_received(ID, button, button_count);
+}
+
+
+// Same vector is not nested, the stack would recurse forever
+static void run_isr(uint8_t *in_isr, void (*isr)(void)){
+	if (*in_isr)
+		return;
+	*in_isr = 1;
+	sim_irq_disable(); //I flag cleared on entry, set again by reti
+	isr();
+	sim_irq_enable();
+	*in_isr = 0;
+}
+
+// Timer compare match in CTC mode, a restart through TCNTn = 0 is seen on the next poll
+// and writing a one to TIFRn clears a pending match, as on the AVR
+typedef struct sim_timer{
+	uint8_t running;
+	uint8_t pending;        // OCFnA, set on a match nobody took yet
+	uint8_t in_isr;
+	uint64_t due;
+}sim_timer;
+
+static sim_timer timer2;
+static uint8_t uart_in_isr;
+static const uint16_t prescale2[8] = {0, 1, 8, 32, 64, 128, 256, 1024};
+
+template<typename T>
+static void poll_timer(sim_timer *t, uint16_t prescale, uint16_t ocr, volatile T &tcnt,
+		volatile uint8_t &tifr, uint8_t enabled, void (*isr)(void), uint64_t now){
+	if (tifr){
+		t->pending = 0;
+		tifr = 0;
+	}
+	if (!prescale){
+		t->running = 0;
+		return;
+	}
+	uint64_t period = (uint64_t)(ocr + 1) * prescale * 1000000 / F_CPU;
+	if (!t->running || tcnt == 0){
+		t->running = 1;
+		t->due = now + period;
+		tcnt = 1;
+	}
+	if (now >= t->due){
+		uint64_t late = now - t->due;
+		t->pending = 1;
+		t->due += period;
+		if (t->due <= now)
+			t->due = now + period;  // Matches the host was too slow for are lost, as one flag holds them on the AVR
+		sim_timer_tick(ID, late, late / period);
+	}
+	if (t->pending && enabled && !t->in_isr){
+		t->pending = 0;
+		run_isr(&t->in_isr, isr);
+	}
+}
+
+static void poll_irqs(uint64_t now){
+	poll_timer(&timer2, prescale2[TCCR2B & 7], OCR2A, TCNT2, TIFR2, TIMSK2 & _BV(OCIE2A), TIMER2_COMPA_vect, now);
+	if ((UCSR0B & _BV(UDRIE0)) && now >= UDR0.busy_until)
+		run_isr(&uart_in_isr, USART0_UDRE_vect);
+}
+
+
+// setup() of main.cpp, then the main loop with events from the traffic generator
+static void node_main(void){
+	init_uart0();
+	sram_init();
+	_delay_ms(100);
+	rfm12_init();
+	_delay_ms(100);
+	sei();
+
+	timer_init();
+	csma_init();
+	mac_always_on |= sim_always_on(ID);
+	init_DLL();
+	init_NET();
+
+	init_transport_layer();
+#if SIM_BENCH
+	init_bench();
+#else
+	init_app_layer();
+#endif
+
+	while(1){
+		poll_PHY();
+		event_dispatch();
+
+#if !SIM_BENCH
+		uint8_t dest, button, button_count;
+		if (sim_poll_send(ID, &dest, &button, &button_count))
+			app_event(button, button_count, dest);
+#endif
+	}
+}
+
+static const sim_node_ops ops = {
+	ID, node_main, poll_irqs, rfm12_sim_rx, rfm12_sim_tx_done
+};
+static int registered = sim_register_node(&ops);
+
+}
@@ -0,0 +1,128 @@
+// Simulated RFM12 for one virtual node, included by sim/node.cpp inside the node's namespace
+// Implements the rfm12lib API (rfm12.h) on top of the shared channel in sim.cpp. Frames
+// are handed over whole, the per-byte FIFO interrupt of the real library is not modelled.
+// Like the RFM12 interrupt on the Il Matto, delivery never waits for cli().
+
+rf_tx_buffer_t rf_tx_buffer;
+rf_rx_buffer_t rf_rx_buffers[RFM12_RX_BUFFER_COUNT];
+rfm12_control_t ctrl;
+static volatile uint8_t rx_enabled;  // ER bit of the power management register
+static volatile uint8_t datarate = DATARATE_VALUE;  // Data rate register, rfm12_set_rate()
+static uint8_t tx_power = RFM12_POWER;  // Power bits of the TX configuration, rfm12_set_power()
+
+// Bit rate the data rate register stands for
+static uint32_t rfm12_sim_bitrate(void){
+	uint8_t r = datarate;
+	if (r & RFM12_DATARATE_CS)
+		return (uint32_t)(10000000.0 / 29.0 / 8.0 / ((r & 0x7f) + 1));
+	return (uint32_t)(10000000.0 / 29.0 / (r + 1));
+}
+
+void rfm12_init(void) {
+	rf_tx_buffer.sync[0] = SYNC_MSB;
+	rf_tx_buffer.sync[1] = SYNC_LSB;
+	ctrl.rfm12_state = STATE_RX_IDLE;
+	ctrl.txstate = STATUS_FREE;
+	ctrl.buffer_in_num = 0;
+	ctrl.buffer_out_num = 0;
+	for (uint8_t i = 0; i < RFM12_RX_BUFFER_COUNT; i++)
+		rf_rx_buffers[i].status = STATUS_FREE;
+	rx_enabled = 1;
+	datarate = DATARATE_VALUE;
+	tx_power = RFM12_POWER;
+	sim_radio_power(ID, 1);
+	RFM12_INT_ON();
+}
+
+void rfm12_set_rate(uint8_t r) {
+	datarate = r;
+}
+
+void rfm12_set_power(uint8_t power) {
+	tx_power = power & RFM12_TXCONF_POWER_MASK;
+}
+
+//transmissions are started by the MAC tick through rfm12_data(), there is nothing to poll
+void rfm12_tick(void) {
+}
+
+uint8_t rfm12_start_tx(uint8_t type, uint8_t length) {
+	if (ctrl.txstate != STATUS_FREE)
+		return RFM12_TX_OCCUPIED;
+
+	rf_tx_buffer.len = length;
+	rf_tx_buffer.type = type;
+	rf_tx_buffer.checksum = length ^ type ^ 0xff;
+	ctrl.txstate = STATUS_OCCUPIED;
+	return RFM12_TX_ENQUEUED;
+}
+
+uint8_t rfm12_tx(uint8_t len, uint8_t type, uint8_t *data) {
+	if (len > RFM12_TX_BUFFER_SIZE)
+		return RFM12_TX_ERROR;
+	if (ctrl.txstate != STATUS_FREE)
+		return RFM12_TX_OCCUPIED;
+
+	memcpy(rf_tx_buffer.buffer, data, len);
+	return rfm12_start_tx(type, len);
+}
+
+void rfm12_rx_clear(void) {
+	rf_rx_buffers[ctrl.buffer_out_num].status = STATUS_FREE;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	ctrl.buffer_out_num = RFM12_RX_NEXT(ctrl.buffer_out_num);
+}
+
+//the transmitter is switched on once the preamble is in the FIFO, the receiver
+//follows the ER bit, a sleeping one neither hears frames nor sees a carrier
+void rfm12_data(uint16_t d) {
+	if ((d & 0xff00) != RFM12_CMD_PWRMGT)
+		return;
+	if ((d & RFM12_PWRMGT_ET) && ctrl.rfm12_state == STATE_TX)
+		sim_channel_tx(ID, rf_tx_buffer.buffer, rf_tx_buffer.len, rf_tx_buffer.type, rfm12_sim_bitrate(), tx_power);
+	else if (!(d & RFM12_PWRMGT_ET)){
+		rx_enabled = (d & RFM12_PWRMGT_ER) != 0;
+		sim_radio_power(ID, rx_enabled);
+	}
+}
+
+uint16_t rfm12_read(uint16_t c) {
+	if (c == RFM12_CMD_STATUS && rx_enabled && sim_channel_busy(ID))
+		return RFM12_STATUS_RSSI;
+	return 0;
+}
+
+//what the RFM12 ISR does with a complete packet
+static void rfm12_sim_rx(const uint8_t *data, uint8_t len, uint8_t type, uint32_t bitrate, uint8_t rssi) {
+	rf_rx_buffer_t *rx = &rf_rx_buffers[ctrl.buffer_in_num];
+
+	if (ctrl.rfm12_state != STATE_RX_IDLE || !rx_enabled)
+		return; //half duplex, frames arriving while sending are lost on the channel already
+	if (bitrate != rfm12_sim_bitrate())
+		return; //tuned to another rate, never finds the sync word
+	if (rx->status != STATUS_FREE || len > RFM12_RX_BUFFER_SIZE) {
+		ctrl.rx_overflow++;
+		sim_count_rx_overflow(ID);
+		return;
+	}
+	memcpy(rx->buffer, data, len);
+	rx->len = len;
+	rx->type = type;
+	rx->checksum = len ^ type ^ 0xff;
+#if RFM12_RX_CRC16
+	rx->crc = crc16_block(CRC16_INIT, data, len);
+#endif
+#if RFM12_RX_RSSI
+	rx->rssi = rssi;
+#endif
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	rx->status = STATUS_COMPLETE;
+	ctrl.buffer_in_num = RFM12_RX_NEXT(ctrl.buffer_in_num);
+}
+
+static void rfm12_sim_tx_done(void) {
+	ctrl.rfm12_state = STATE_RX_IDLE;
+	ctrl.txstate = STATUS_FREE;
+	rx_enabled = 1; //ISR writes PWRMGT_RECEIVE after the last byte
+	sim_radio_power(ID, 1);
+}
@@ -0,0 +1,581 @@
+// Host-side simulator: shared radio channel, node scheduling, traffic and report
+// Each virtual node runs its main loop on its own thread. Timer ISRs are run by the
+// node itself whenever it polls (sim_idle) or delays (sim_sleep_us) with interrupts
+// enabled, so the firmware never sees two of its contexts running at the same time.
+#include "sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#define SIM_MAX_FRAME 255       // Largest frame handed to the channel, all the length byte allows
+#define SIM_OVERHEAD 8          // 2 preamble, 2 sync, length, type, checksum, dummy byte
+#define SIM_MAX_EVENTS 250      // Sequence number travels in one APP byte, 0 is padding
+#define SIM_APP_BYTES 2         // One event is button + button_count
+#define SIM_BER_BITRATE 115200  // Bit rate -b is given for
+#define SIM_RSSI_BER 1000       // Bit errors per 10^6 at SIM_BER_BITRATE below which the RSSI reads a signal
+
+// Options
+typedef struct sim_options{
+    const char *pattern;
+    uint16_t events;            // Events per flow
+    uint8_t window;             // Events a flow may have outstanding
+    uint8_t loss;               // Frame loss in percent
+    uint32_t ber;               // Bit errors per million bits of a frame received
+    uint32_t delay_us;          // Extra delay between end of frame and delivery
+    double speed;               // Simulated time per real time
+    uint32_t timeout_ms;        // Event counts as lost after this long
+    uint32_t limit_ms;          // Whole run is stopped after this long
+    uint8_t line;               // 1 = node k only hears k-1 and k+1
+    uint32_t seed;
+    uint8_t verbose;
+    uint8_t always_on;          // Bit per node, forwarders whose receiver never sleeps
+}sim_options;
+
+static sim_options opt = {"unicast", 10, 1, 0, 0, 0, 1.0, 20000, 600000, 0, 1, 0, 0};
+
+// Nodes
+typedef struct sim_node{
+    const sim_node_ops *ops;
+    uint8_t irq_enabled;
+    char line[128];             // UART output collected up to the next newline
+    uint8_t line_len;
+}sim_node;
+
+static sim_node nodes[SIM_MAX_NODES];
+static uint8_t node_count;
+static thread_local int current = -1;
+static std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+
+// Channel
+typedef struct air_frame{
+    uint8_t src;
+    uint8_t len;
+    uint8_t type;
+    uint8_t data[SIM_MAX_FRAME];
+    uint32_t bitrate;           // Only a receiver tuned to the same rate gets the frame
+    uint8_t power;              // TX power in 3 dB steps below full
+    uint64_t start;
+    uint64_t end;
+    uint8_t tx_done;
+    uint8_t delivered;
+}air_frame;
+
+static std::mutex ch_mtx;
+static std::condition_variable ch_cv;
+static std::deque<air_frame> air;
+static std::mt19937 ch_rng;
+
+// Statistics
+typedef struct sim_stats{
+    uint32_t frames;
+    uint32_t air_bytes;
+    uint32_t received;
+    uint32_t collisions;
+    uint32_t lost;
+    uint32_t flipped;           // Bits flipped by -b
+    uint32_t overflows;
+}sim_stats;
+
+static sim_stats stats;
+
+// Receiver on time per node, the duty cycle of low power listening
+typedef struct sim_power{
+    uint8_t rx_on;
+    uint64_t since;             // When rx_on last changed
+    uint64_t on_us;             // Receiver on before that
+}sim_power;
+
+static std::mutex pw_mtx;
+static sim_power power[SIM_MAX_NODES];
+
+// Timer matches of all nodes. The clock follows the host, so a host that cannot keep up
+// at -s runs the timer ISRs late or skips them and the figures are not those of the stack.
+typedef struct sim_clock{
+    uint32_t ticks;
+    uint32_t missed;
+    uint64_t late_us;
+    uint64_t max_late_us;
+}sim_clock;
+
+static std::mutex ck_mtx;
+static sim_clock clk;
+
+#define SIM_MISSED_PCT 1        // Missed timer matches above which the report warns
+
+// Traffic
+typedef struct sim_flow{
+    uint8_t src;
+    uint8_t dst;
+    uint16_t next;                      // Next sequence number to send, starts at 1
+    uint16_t outstanding;
+    uint16_t delivered;
+    uint16_t expired;
+    uint64_t sent_at[SIM_MAX_EVENTS + 1];
+    uint8_t state[SIM_MAX_EVENTS + 1];  // 0 not sent, 1 in flight, 2 delivered, 3 expired
+}sim_flow;
+
+static std::mutex tr_mtx;
+static std::vector<sim_flow> flows;
+static std::vector<uint32_t> latencies;
+static uint64_t first_send;
+static uint64_t last_delivery;
+
+#define SIM_START_US 500000     // Give every node time to run its setup
+
+
+uint64_t sim_now_us(void){
+    std::chrono::duration<double, std::micro> d = std::chrono::steady_clock::now() - t0;
+    return (uint64_t)(d.count() * opt.speed);
+}
+
+static void real_sleep(uint64_t sim_us){
+    std::this_thread::sleep_for(std::chrono::duration<double, std::micro>(sim_us / opt.speed));
+}
+
+static void run_timers(void){
+    if(current >= 0 && nodes[current].irq_enabled)
+        nodes[current].ops->poll_irqs(sim_now_us());
+}
+
+void sim_idle(void){
+    run_timers();
+    real_sleep(20);
+}
+
+void sim_sleep_us(uint32_t us){
+    uint64_t until = sim_now_us() + us;
+    uint64_t now;
+    while((now = sim_now_us()) < until){
+        run_timers();
+        real_sleep(std::min<uint64_t>(until - now, 1000));
+    }
+}
+
+void sim_irq_disable(void){
+    if(current >= 0)
+        nodes[current].irq_enabled = 0;
+}
+
+void sim_irq_enable(void){
+    if(current >= 0)
+        nodes[current].irq_enabled = 1;
+}
+
+uint8_t sim_irq_save(void){
+    if(current < 0)
+        return 0;
+    uint8_t enabled = nodes[current].irq_enabled;
+    nodes[current].irq_enabled = 0;
+    return enabled;
+}
+
+void sim_irq_restore(uint8_t enabled){
+    if(current >= 0 && enabled)
+        nodes[current].irq_enabled = 1;
+}
+
+int sim_register_node(const sim_node_ops *ops){
+    if(ops->id >= SIM_MAX_NODES || nodes[ops->id].ops)
+        abort();
+    nodes[ops->id].ops = ops;
+    node_count++;
+    return ops->id;
+}
+
+void sim_bind_thread(uint8_t id){
+    current = id;
+}
+
+
+//Channel
+static uint8_t hears(uint8_t a, uint8_t b){
+    if(a == b)
+        return 0;
+    if(opt.line)
+        return (a > b ? a - b : b - a) == 1;
+    return 1;
+}
+
+void sim_channel_tx(uint8_t id, const uint8_t *data, uint8_t len, uint8_t type, uint32_t bitrate, uint8_t power){
+    air_frame f;
+    memset(&f, 0, sizeof(f));
+    f.src = id;
+    f.len = len > SIM_MAX_FRAME ? SIM_MAX_FRAME : len;
+    f.type = type;
+    memcpy(f.data, data, f.len);
+    f.bitrate = bitrate;
+    f.power = power;
+    f.start = sim_now_us();
+    f.end = f.start + (uint64_t)(len + SIM_OVERHEAD) * 8 * 1000000 / bitrate;
+
+    std::lock_guard<std::mutex> lock(ch_mtx);
+    stats.frames++;
+    stats.air_bytes += len + SIM_OVERHEAD;
+    air.push_back(f);
+    ch_cv.notify_one();
+}
+
+uint8_t sim_channel_busy(uint8_t id){
+    uint64_t now = sim_now_us();
+    std::lock_guard<std::mutex> lock(ch_mtx);
+    for(const air_frame &f : air)
+        if(f.start <= now && now < f.end && hears(f.src, id))
+            return 1;
+    return 0;
+}
+
+// Only called back from radio_rx(), the channel thread already holds ch_mtx
+void sim_count_rx_overflow(uint8_t id){
+    stats.overflows++;
+}
+
+void sim_radio_power(uint8_t id, uint8_t rx_on){
+    uint64_t now = sim_now_us();
+    std::lock_guard<std::mutex> lock(pw_mtx);
+    sim_power &p = power[id];
+    if(p.rx_on == rx_on)
+        return;
+    if(p.rx_on)
+        p.on_us += now - p.since;
+    p.rx_on = rx_on;
+    p.since = now;
+}
+
+uint8_t sim_always_on(uint8_t id){
+    return (opt.always_on >> id) & 1;
+}
+
+void sim_timer_tick(uint8_t id, uint64_t late_us, uint32_t missed){
+    std::lock_guard<std::mutex> lock(ck_mtx);
+    clk.ticks++;
+    clk.missed += missed;
+    clk.late_us += late_us;
+    clk.max_late_us = std::max(clk.max_late_us, late_us);
+}
+
+// Frame f reaches r unless r was sending itself or heard another frame at the same time
+static uint8_t collided(const air_frame &f, uint8_t r){
+    for(const air_frame &g : air){
+        if(&g == &f || g.end <= f.start || g.start >= f.end)
+            continue;
+        if(g.src == r || hears(g.src, r))
+            return 1;
+    }
+    return 0;
+}
+
+static void channel_thread(void){
+    std::unique_lock<std::mutex> lock(ch_mtx);
+    std::uniform_int_distribution<int> percent(0, 99);
+    std::uniform_int_distribution<uint32_t> ppm(0, 999999);
+
+    while(1){
+        uint64_t now = sim_now_us();
+        uint64_t next = UINT64_MAX;
+
+        for(air_frame &f : air){
+            if(!f.tx_done){
+                if(f.end <= now){
+                    f.tx_done = 1;
+                    nodes[f.src].ops->radio_tx_done();
+                }
+                else
+                    next = std::min(next, f.end);
+            }
+            if(!f.delivered){
+                if(f.end + opt.delay_us <= now){
+                    f.delivered = 1;
+                    for(uint8_t r = 0; r < SIM_MAX_NODES; r++){
+                        if(!nodes[r].ops || !hears(f.src, r))
+                            continue;
+                        if(collided(f, r))
+                            stats.collisions++;
+                        else if(percent(ch_rng) < opt.loss)
+                            stats.lost++;
+                        else{
+                            stats.received++;
+                            // Every receiver gets the bits wrong on its own. -b holds at 115.2 kbit/s and
+                            // full power, the noise grows with the bandwidth and every 3 dB less doubles it.
+                            uint32_t ber = std::min<uint64_t>((uint64_t)opt.ber * f.bitrate / SIM_BER_BITRATE << f.power, 500000);
+                            uint8_t data[SIM_MAX_FRAME];
+                            memcpy(data, f.data, f.len);
+                            for(uint16_t b = 0; ber && b < f.len * 8; b++){
+                                if(ppm(ch_rng) < ber){
+                                    data[b / 8] ^= 1 << (b % 8);
+                                    stats.flipped++;
+                                }
+                            }
+                            // RSSI only sees the signal: above the threshold while it would carry
+                            // 115.2 kbit/s with fewer than SIM_RSSI_BER errors
+                            uint8_t rssi = ((uint64_t)opt.ber << f.power) < SIM_RSSI_BER;
+                            nodes[r].ops->radio_rx(data, f.len, f.type, f.bitrate, rssi);
+                        }
+                    }
+                }
+                else
+                    next = std::min(next, f.end + opt.delay_us);
+            }
+        }
+        // Frames are kept a while after delivery, later ones may still overlap them
+        while(!air.empty() && air.front().delivered && air.front().end + 1000000 < now)
+            air.pop_front();
+
+        if(next == UINT64_MAX)
+            ch_cv.wait_for(lock, std::chrono::milliseconds(10));
+        else if(next > now)
+            ch_cv.wait_for(lock, std::chrono::duration<double, std::micro>((next - now) / opt.speed));
+    }
+}
+
+
+//Traffic
+static void add_flow(uint8_t src, uint8_t dst){
+    sim_flow fl;
+    memset(&fl, 0, sizeof(fl));
+    fl.src = src;
+    fl.dst = dst;
+    fl.next = 1;
+    flows.push_back(fl);
+}
+
+static uint8_t setup_pattern(void){
+    if(!strcmp(opt.pattern, "unicast"))
+        add_flow(0, 1);
+    else if(!strcmp(opt.pattern, "burst")){
+        add_flow(0, 1);
+        if(opt.window < 2)
+            opt.window = 4;
+    }
+    else if(!strcmp(opt.pattern, "all-to-one")){
+        for(uint8_t k = 1; k < node_count; k++)
+            add_flow(k, 0);
+    }
+    else if(!strcmp(opt.pattern, "relay")){
+        add_flow(0, node_count - 1);
+        opt.line = 1;
+    }
+    else
+        return 0;
+    return 1;
+}
+
+uint8_t sim_poll_send(uint8_t id, uint8_t *dest, uint8_t *button, uint8_t *button_count){
+    uint64_t now = sim_now_us();
+    if(now < SIM_START_US)
+        return 0;
+
+    std::lock_guard<std::mutex> lock(tr_mtx);
+    for(sim_flow &fl : flows){
+        if(fl.src != id || fl.next > opt.events || fl.outstanding >= opt.window)
+            continue;
+        if(!first_send)
+            first_send = now;
+        fl.sent_at[fl.next] = now;
+        fl.state[fl.next] = 1;
+        fl.outstanding++;
+        *dest = fl.dst;
+        *button = fl.src + 1;
+        *button_count = fl.next++;
+        return 1;
+    }
+    return 0;
+}
+
+void sim_event_received(uint8_t id, uint8_t button, uint8_t button_count){
+    uint64_t now = sim_now_us();
+
+    std::lock_guard<std::mutex> lock(tr_mtx);
+    for(sim_flow &fl : flows){
+        if(fl.src + 1 != button || fl.dst != id || button_count > SIM_MAX_EVENTS)
+            continue;
+        if(fl.state[button_count] != 1)
+            return;                     // Duplicate, or arrived after it was given up
+        fl.state[button_count] = 2;
+        fl.outstanding--;
+        fl.delivered++;
+        latencies.push_back((uint32_t)(now - fl.sent_at[button_count]));
+        last_delivery = now;
+        return;
+    }
+}
+
+// Gives up on events older than the timeout, returns 1 once every flow is finished
+static uint8_t traffic_done(uint64_t now){
+    uint8_t done = 1;
+    std::lock_guard<std::mutex> lock(tr_mtx);
+    for(sim_flow &fl : flows){
+        for(uint16_t s = 1; s < fl.next; s++){
+            if(fl.state[s] == 1 && now - fl.sent_at[s] > (uint64_t)opt.timeout_ms * 1000){
+                fl.state[s] = 3;
+                fl.outstanding--;
+                fl.expired++;
+            }
+        }
+        if(fl.next <= opt.events || fl.outstanding)
+            done = 0;
+    }
+    return done;
+}
+
+
+void sim_log(uint8_t id, const char *str){
+    if(!opt.verbose)
+        return;
+    sim_node *n = &nodes[id];
+    for(; *str; str++){
+        if(*str == '\r')
+            continue;
+        if(*str == '\n' || n->line_len == sizeof(n->line) - 1){
+            n->line[n->line_len] = 0;
+            if(n->line_len)
+                fprintf(stderr, "%10.3f n%d: %s\n", sim_now_us() / 1000.0, id, n->line);
+            n->line_len = 0;
+            if(*str == '\n')
+                continue;
+        }
+        n->line[n->line_len++] = *str;
+    }
+}
+
+
+static void report(uint64_t end){
+    uint32_t sent = 0, delivered = 0, expired = 0;
+    for(const sim_flow &fl : flows){
+        sent += fl.next - 1;
+        delivered += fl.delivered;
+        expired += fl.expired;
+    }
+    uint32_t app_bytes = delivered * SIM_APP_BYTES;
+    uint64_t span = (last_delivery > first_send ? last_delivery : end) - first_send;
+    double goodput = span ? app_bytes * 1e6 / span : 0;
+    double frames_per_byte = app_bytes ? (double)stats.frames / app_bytes : 0;
+
+    double rx_on = 0;
+    {
+        std::lock_guard<std::mutex> lock(pw_mtx);
+        for(uint8_t i = 0; i < node_count; i++){
+            const sim_power &p = power[i];
+            uint64_t on = p.on_us + (p.rx_on ? end - p.since : 0);
+            rx_on += end ? 100.0 * on / end / node_count : 0;
+        }
+    }
+
+    sim_clock ck;
+    {
+        std::lock_guard<std::mutex> lock(ck_mtx);
+        ck = clk;
+    }
+    double missed = (ck.ticks + ck.missed) ? 100.0 * ck.missed / (ck.ticks + ck.missed) : 0;
+
+    double mean = 0;
+    uint32_t p50 = 0, max = 0;
+    if(!latencies.empty()){
+        std::sort(latencies.begin(), latencies.end());
+        for(uint32_t l : latencies)
+            mean += l;
+        mean /= latencies.size();
+        p50 = latencies[latencies.size() / 2];
+        max = latencies.back();
+    }
+
+    printf("pattern       %s (%d nodes, %s topology)\n", opt.pattern, node_count, opt.line ? "line" : "full");
+    printf("channel       %d%% loss, %.1f ms delay, %u bit errors per 10^6 (%u flipped)\n", opt.loss, opt.delay_us / 1000.0, opt.ber, stats.flipped);
+    printf("events        %u sent, %u delivered, %u lost\n", sent, delivered, expired);
+    printf("goodput       %.2f B/s\n", goodput);
+    printf("frames        %u sent, %.1f per app byte, %u bytes on air\n", stats.frames, frames_per_byte, stats.air_bytes);
+    printf("radio         %u received, %u collided, %u lost, %u overflowed\n", stats.received, stats.collisions, stats.lost, stats.overflows);
+    printf("latency       mean %.1f ms, p50 %.1f ms, max %.1f ms\n", mean / 1000, p50 / 1000.0, max / 1000.0);
+    printf("receiver      on %.1f%% of the time, mean of all nodes\n", rx_on);
+    printf("clock         %u timer ticks, %u missed (%.1f%%), mean %.2f ms late, max %.1f ms late\n",
+        ck.ticks, ck.missed, missed, ck.ticks ? ck.late_us / 1000.0 / ck.ticks : 0, ck.max_late_us / 1000.0);
+    // One line for scripts comparing runs
+    printf("RESULT pattern=%s nodes=%d sent=%u delivered=%u goodput=%.2f frames_per_byte=%.2f lat_mean_ms=%.1f lat_p50_ms=%.1f lat_max_ms=%.1f rx_on_pct=%.1f missed_ticks_pct=%.1f\n",
+        opt.pattern, node_count, sent, delivered, goodput, frames_per_byte, mean / 1000, p50 / 1000.0, max / 1000.0, rx_on, missed);
+    fflush(stdout);
+    if(missed > SIM_MISSED_PCT)
+        fprintf(stderr, "warning: the host fell behind the simulated clock, %.1f%% of timer ticks were missed and "
+            "the figures above are not valid, run at -s 1 on an idle host\n", missed);
+}
+
+static void usage(const char *prg){
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -p pattern   unicast, burst, all-to-one or relay (default unicast)\n"
+        "  -e events    events per flow, at most %d (default 10)\n"
+        "  -w window    events a flow may have in flight (default 1, burst 4)\n"
+        "  -l loss      frame loss in percent (default 0)\n"
+        "  -b ber       bit errors per million bits at 115.2 kbit/s and full power (default 0)\n"
+        "  -d delay     extra delivery delay in ms (default 0)\n"
+        "  -s speed     simulated time per real time (default 1), figures are only valid at 1 on an idle host\n"
+        "  -t timeout   ms before an event counts as lost (default 20000)\n"
+        "  -m limit     ms before the whole run is stopped (default 600000)\n"
+        "  -L           line topology, node k only hears k-1 and k+1\n"
+        "  -r seed      channel loss seed (default 1)\n"
+        "  -a ids       comma separated nodes whose receiver never sleeps (MAC_LPL=1)\n"
+        "  -v           print UART output of every node to stderr\n",
+        prg, SIM_MAX_EVENTS);
+    exit(2);
+}
+
+int main(int argc, char *argv[]){
+    int c;
+    while((c = getopt(argc, argv, "p:e:w:l:b:d:s:t:m:Lr:a:v")) != -1){
+        switch(c){
+        case 'p': opt.pattern = optarg; break;
+        case 'e': opt.events = std::min(atoi(optarg), SIM_MAX_EVENTS); break;
+        case 'w': opt.window = atoi(optarg); break;
+        case 'l': opt.loss = atoi(optarg); break;
+        case 'b': opt.ber = atoi(optarg); break;
+        case 'd': opt.delay_us = atof(optarg) * 1000; break;
+        case 's': opt.speed = atof(optarg); break;
+        case 't': opt.timeout_ms = atoi(optarg); break;
+        case 'm': opt.limit_ms = atoi(optarg); break;
+        case 'L': opt.line = 1; break;
+        case 'r': opt.seed = atoi(optarg); break;
+        case 'a':
+            for(char *s = optarg; *s; s++){
+                if(*s >= '0' && *s < '0' + SIM_MAX_NODES)
+                    opt.always_on |= 1 << (*s - '0');
+            }
+            break;
+        case 'v': opt.verbose = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+    for(uint8_t i = 0; i < node_count; i++)
+        if(!nodes[i].ops){
+            fprintf(stderr, "node ids must be 0..%d\n", node_count - 1);
+            return 2;
+        }
+    if(opt.speed <= 0 || !opt.window || node_count < 2 || !setup_pattern())
+        usage(argv[0]);
+    ch_rng.seed(opt.seed);
+
+    t0 = std::chrono::steady_clock::now();
+    std::thread(channel_thread).detach();
+    for(uint8_t i = 0; i < node_count; i++){
+        std::thread([i]{
+            sim_bind_thread(i);
+            nodes[i].ops->main_loop();
+        }).detach();
+    }
+
+    uint64_t now;
+    while((now = sim_now_us()) < (uint64_t)opt.limit_ms * 1000 && !traffic_done(now))
+        real_sleep(10000);
+
+    std::lock_guard<std::mutex> lock(tr_mtx);
+    report(now);
+    // Node threads never return, leave without unwinding them
+    _exit(last_delivery ? 0 : 1);
+}
@@ -0,0 +1,51 @@
+// Host-side simulator for the protocol stack
+// Every virtual node is the full stack (1_PHY .. 5_APP) compiled into its own
+// namespace by sim/node.cpp, talking to a mock of the rfm12lib API. The mock
+// radios share one simulated channel with configurable loss and delay.
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+
+#define SIM_MAX_NODES 8
+
+// Simulated clock, microseconds since start (real time scaled by -s speed). It follows the
+// host clock, so a host too busy to keep up runs the timers late, see sim_timer_tick()
+uint64_t sim_now_us(void);
+void sim_sleep_us(uint32_t us);
+void sim_idle(void);                    // Called from polling loops, gives the CPU to the other nodes
+
+// Interrupt flag of the node the calling thread belongs to
+void sim_irq_disable(void);
+void sim_irq_enable(void);
+uint8_t sim_irq_save(void);             // Disable, returns 1 if interrupts were enabled
+void sim_irq_restore(uint8_t enabled);
+
+// Hooks a virtual node hands to the simulator
+typedef struct sim_node_ops{
+    uint8_t id;
+    void (*main_loop)(void);                                    // Main context, never returns
+    void (*poll_irqs)(uint64_t now);                            // Run due ISRs, called by the node itself when it polls
+    void (*radio_rx)(const uint8_t *data, uint8_t len, uint8_t type, uint32_t bitrate, uint8_t rssi); // Frame arrived over the air
+    void (*radio_tx_done)(void);                                // Own frame has left the antenna
+}sim_node_ops;
+
+int sim_register_node(const sim_node_ops *ops);
+void sim_bind_thread(uint8_t id);       // Mark calling thread as running on node id
+
+// Channel, called by the mock radio of node id
+void sim_channel_tx(uint8_t id, const uint8_t *data, uint8_t len, uint8_t type, uint32_t bitrate, uint8_t power); // power in 3 dB steps below full
+uint8_t sim_channel_busy(uint8_t id);   // 1 if node id currently senses a carrier (RSSI)
+void sim_count_rx_overflow(uint8_t id); // Frame dropped because every RX buffer was full
+void sim_radio_power(uint8_t id, uint8_t rx_on);    // Receiver of node id switched on or off
+uint8_t sim_always_on(uint8_t id);      // 1 if node id was made a forwarder that never sleeps (-a)
+void sim_timer_tick(uint8_t id, uint64_t late_us, uint32_t missed); // Timer match of node id seen late_us late, missed matches skipped
+
+// Traffic generator and statistics, called from the node's main loop
+uint8_t sim_poll_send(uint8_t id, uint8_t *dest, uint8_t *button, uint8_t *button_count); // 1 if an event is due
+void sim_event_received(uint8_t id, uint8_t button, uint8_t button_count);
+
+// UART output of node id
+void sim_log(uint8_t id, const char *str);
+
+#endif
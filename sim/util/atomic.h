@@ -0,0 +1,14 @@
+// Host shim for <util/atomic.h>
+#ifndef SIM_UTIL_ATOMIC_H
+#define SIM_UTIL_ATOMIC_H
+
+#include "../sim.h"
+
+#define ATOMIC_RESTORESTATE 0
+#define ATOMIC_FORCEON 1
+
+#define ATOMIC_BLOCK(type) \
+	for (uint8_t sim_sreg_ = sim_irq_save(), sim_todo_ = 1; sim_todo_; \
+	     sim_irq_restore((type) == ATOMIC_FORCEON ? 1 : sim_sreg_), sim_todo_ = 0)
+
+#endif
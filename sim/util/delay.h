@@ -0,0 +1,10 @@
+// Host shim for <util/delay.h>, delays run on the simulated clock
+#ifndef SIM_UTIL_DELAY_H
+#define SIM_UTIL_DELAY_H
+
+#include "../sim.h"
+
+#define _delay_ms(ms) sim_sleep_us((uint32_t)((ms) * 1000.0))
+#define _delay_us(us) sim_sleep_us((uint32_t)(us))
+
+#endif